@@ -0,0 +1,500 @@
+#include "RBcompact.h"
+#include "RBload_priv.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+/* Nodes are named by their index in the node array. Index 0 is the nil
+ * sentinel, which is black and is never written after creation. */
+typedef uint32_t rb_idx;
+struct rb_cnode {
+	int key;
+	rb_idx lchild, rchild;
+	rb_idx parent; /* the top bit is set if the node is red */
+};
+#define RB_NIL       0
+#define RB_RED       0x80000000u
+#define RB_MAX_NODES 0x7fffffffu /* indices must leave the color bit free */
+#define RB_MIN_CAP   64
+
+struct rb_compact {
+	struct rb_cnode *nodes;
+	rb_idx root;
+	rb_idx len, cap;   /* array slots used (including nil) and allocated */
+	rb_idx free_nodes; /* deleted nodes, linked through lchild */
+	size_t count;
+};
+
+/* Field access. The node array moves when it grows, so nodes are always
+ * reached through the tree rather than held as pointers. */
+#define NODE(t, i)          ((t)->nodes[i])
+#define PARENT(t, i)        (NODE(t, i).parent & ~RB_RED)
+#define IS_RED(t, i)        ((NODE(t, i).parent & RB_RED) != 0)
+#define SET_PARENT(t, i, p) (NODE(t, i).parent = (NODE(t, i).parent & RB_RED) | (p))
+#define SET_RED(t, i)       (NODE(t, i).parent |= RB_RED)
+#define SET_BLACK(t, i)     (NODE(t, i).parent &= ~RB_RED)
+#define SET_COLOR(t, i, red) ((red) ? SET_RED(t, i) : SET_BLACK(t, i))
+
+/* Section 1: Creating and freeing trees and nodes */
+/* Creates a new red node, growing the node array if needed. */
+static rb_idx rb_cnew(rb_compact t, int key);
+/* Puts a node on the list of deleted nodes. */
+static void rb_cfree(rb_compact t, rb_idx n);
+/* Section 2: Insertion */
+/* Corrects for properties violated on an insertion. */
+static void rb_cinsert_fix(rb_compact t, rb_idx n);
+/* Section 3: Deletion */
+/* Transplants node `from' into node `to's position. */
+static void rb_ctransplant(rb_compact t, rb_idx to, rb_idx from);
+/* Corrects for properties violated on a deletion; n may be nil. */
+static void rb_cdelete_fix(rb_compact t, rb_idx n, rb_idx parent);
+/* Section 4: I/O */
+/* Helper routine: makes a node for rb_load_preorder. */
+static rb_load_node rb_cload_make(void *tree, int key, int red);
+/* Helper routine: links a node for rb_load_preorder. */
+static void rb_cload_link(void *tree, rb_load_node parent, rb_load_node child,
+		int right);
+/* How rb_load_preorder builds an rb_compact. Node handles are indices, so
+ * RB_NIL is the 0 that means no node. */
+static const struct rb_load_ops rb_compact_load = { rb_cload_make, rb_cload_link };
+/* Rebuilds a freshly read tree into a valid shape. Returns 0 if out of memory,
+ * leaving the tree as it was. */
+static int rb_crebuild(rb_compact t);
+/* Section 5: General helper routines */
+/* Rotates a tree around the given root. */
+static void rb_crotate(rb_compact t, rb_idx root, int go_left);
+
+
+/******************************************************************************
+ * Section 1: Creation and Deallocation
+ *****************************************************************************/
+/* Creates an empty compact tree. */
+rb_compact RBcompact_create() {
+	rb_compact ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	if ((ret->nodes = malloc(RB_MIN_CAP * sizeof(*ret->nodes))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		free(ret);
+		return NULL;
+	}
+	ret->nodes[RB_NIL].key = 0;
+	ret->nodes[RB_NIL].lchild = RB_NIL;
+	ret->nodes[RB_NIL].rchild = RB_NIL;
+	ret->nodes[RB_NIL].parent = RB_NIL;
+	ret->root = RB_NIL;
+	ret->len = 1;
+	ret->cap = RB_MIN_CAP;
+	ret->free_nodes = RB_NIL;
+	ret->count = 0;
+	return ret;
+}
+/* Frees an entire compact tree. */
+void RBcompact_free(rb_compact tree) {
+	free(tree->nodes);
+	free(tree);
+}
+/* Creates a new red node, growing the node array if needed. */
+static rb_idx rb_cnew(rb_compact t, int key) {
+	rb_idx ret;
+	if (t->free_nodes != RB_NIL) {
+		ret = t->free_nodes;
+		t->free_nodes = NODE(t, ret).lchild;
+	} else {
+		if (t->len == t->cap) {
+			size_t cap = (size_t)t->cap * 2;
+			struct rb_cnode *nodes;
+			if (cap > (size_t)RB_MAX_NODES + 1) cap = (size_t)RB_MAX_NODES + 1;
+			if (cap == t->cap) {
+				fprintf(stderr, "Error: compact tree is full.\n");
+				return RB_NIL;
+			}
+			if ((nodes = realloc(t->nodes, cap * sizeof(*nodes))) == NULL) {
+				fprintf(stderr, "Error: out of memory.\n");
+				return RB_NIL;
+			}
+			t->nodes = nodes;
+			t->cap = (rb_idx)cap;
+		}
+		ret = t->len++;
+	}
+	NODE(t, ret).key = key;
+	NODE(t, ret).lchild = RB_NIL;
+	NODE(t, ret).rchild = RB_NIL;
+	NODE(t, ret).parent = RB_NIL | RB_RED;
+	return ret;
+}
+/* Puts a node on the list of deleted nodes. */
+static void rb_cfree(rb_compact t, rb_idx n) {
+	NODE(t, n).lchild = t->free_nodes;
+	t->free_nodes = n;
+}
+
+
+
+
+/******************************************************************************
+ * Section 2: Insertion
+ *****************************************************************************/
+/* Inserts an element with specified key into tree. */
+int RBcompact_insert(rb_compact t, int key) {
+	rb_idx parent = RB_NIL, pos = t->root, n;
+	/* Locate the correct position */
+	while (pos != RB_NIL) {
+		parent = pos;
+		if (key < NODE(t, pos).key) {
+			pos = NODE(t, pos).lchild;
+		} else if (key > NODE(t, pos).key) {
+			pos = NODE(t, pos).rchild;
+		} else {
+			fprintf(stderr, "Error: node %i already in the tree.\n", key);
+			return 0;
+		}
+	}
+	if ((n = rb_cnew(t, key)) == RB_NIL) {
+		return 0;
+	}
+	SET_PARENT(t, n, parent);
+	if (parent == RB_NIL) {
+		t->root = n;
+	} else if (key < NODE(t, parent).key) {
+		NODE(t, parent).lchild = n;
+	} else {
+		NODE(t, parent).rchild = n;
+	}
+	rb_cinsert_fix(t, n);
+	t->count++;
+	return 1;
+}
+/* Corrects for properties violated on an insertion. */
+static void rb_cinsert_fix(rb_compact t, rb_idx n) {
+	while (IS_RED(t, PARENT(t, n))) {
+		rb_idx p = PARENT(t, n), gp = PARENT(t, p);
+		int p_is_left = (p == NODE(t, gp).lchild);
+		rb_idx uncle = p_is_left ? NODE(t, gp).rchild : NODE(t, gp).lchild;
+		/* Case 1: uncle is colored red */
+		if (IS_RED(t, uncle)) {
+			SET_BLACK(t, p);
+			SET_BLACK(t, uncle);
+			SET_RED(t, gp);
+			n = gp;
+			continue;
+		}
+		/* Case 2: node is "close to" uncle */
+		if (n == (p_is_left ? NODE(t, p).rchild : NODE(t, p).lchild)) {
+			n = p;
+			rb_crotate(t, n, p_is_left);
+			p = PARENT(t, n);
+		} /* Fall through */
+		/* Case 3: node is "far from" uncle */
+		SET_BLACK(t, p);
+		SET_RED(t, gp);
+		rb_crotate(t, gp, !p_is_left);
+	}
+	SET_BLACK(t, t->root);
+}
+
+
+
+
+/******************************************************************************
+ * Section 3: Deletion
+ *****************************************************************************/
+/* Deletes an element with a particular key. */
+int RBcompact_delete(rb_compact t, int key) {
+	rb_idx dead = t->root, fixit, fixparent;
+	int orig_red;
+	while (dead != RB_NIL && NODE(t, dead).key != key) {
+		dead = (key < NODE(t, dead).key) ? NODE(t, dead).lchild
+			: NODE(t, dead).rchild;
+	}
+	if (dead == RB_NIL) {
+		fprintf(stderr, "Error: node %i does not exist.\n", key);
+		return 0;
+	}
+	orig_red = IS_RED(t, dead);
+	if (NODE(t, dead).lchild == RB_NIL) {
+		fixit = NODE(t, dead).rchild;
+		fixparent = PARENT(t, dead);
+		rb_ctransplant(t, dead, fixit);
+	} else if (NODE(t, dead).rchild == RB_NIL) {
+		fixit = NODE(t, dead).lchild;
+		fixparent = PARENT(t, dead);
+		rb_ctransplant(t, dead, fixit);
+	} else {
+		/* Replace dead with its successor */
+		rb_idx successor = NODE(t, dead).rchild;
+		while (NODE(t, successor).lchild != RB_NIL) {
+			successor = NODE(t, successor).lchild;
+		}
+		orig_red = IS_RED(t, successor);
+		fixit = NODE(t, successor).rchild;
+		if (PARENT(t, successor) == dead) {
+			fixparent = successor;
+		} else {
+			fixparent = PARENT(t, successor);
+			rb_ctransplant(t, successor, fixit);
+			NODE(t, successor).rchild = NODE(t, dead).rchild;
+			SET_PARENT(t, NODE(t, successor).rchild, successor);
+		}
+		rb_ctransplant(t, dead, successor);
+		NODE(t, successor).lchild = NODE(t, dead).lchild;
+		SET_PARENT(t, NODE(t, successor).lchild, successor);
+		SET_COLOR(t, successor, IS_RED(t, dead));
+	}
+	rb_cfree(t, dead);
+	if (!orig_red) {
+		rb_cdelete_fix(t, fixit, fixparent);
+	}
+	t->count--;
+	return 1;
+}
+/* Transplants node `from' into node `to's position. */
+static void rb_ctransplant(rb_compact t, rb_idx to, rb_idx from) {
+	rb_idx parent = PARENT(t, to);
+	if (parent == RB_NIL) {
+		t->root = from;
+	} else if (to == NODE(t, parent).lchild) {
+		NODE(t, parent).lchild = from;
+	} else {
+		NODE(t, parent).rchild = from;
+	}
+	if (from != RB_NIL) {
+		SET_PARENT(t, from, parent);
+	}
+}
+/* Corrects for properties violated on a deletion; n may be nil. */
+static void rb_cdelete_fix(rb_compact t, rb_idx n, rb_idx parent) {
+	while (n != t->root && !IS_RED(t, n)) {
+		int is_left = (n == NODE(t, parent).lchild);
+		rb_idx sibling = is_left ? NODE(t, parent).rchild : NODE(t, parent).lchild;
+		/* Case 1: sibling red */
+		if (IS_RED(t, sibling)) {
+			SET_BLACK(t, sibling);
+			SET_RED(t, parent);
+			rb_crotate(t, parent, is_left);
+			sibling = is_left ? NODE(t, parent).rchild : NODE(t, parent).lchild;
+		}
+		/* Case 2: sibling black, both sibling's children black */
+		if (!IS_RED(t, NODE(t, sibling).lchild) && !IS_RED(t, NODE(t, sibling).rchild)) {
+			SET_RED(t, sibling);
+			n = parent;
+			parent = PARENT(t, n);
+		} else {
+			/* Case 3: sibling black, "far" child black */
+			rb_idx far = is_left ? NODE(t, sibling).rchild : NODE(t, sibling).lchild;
+			if (!IS_RED(t, far)) {
+				SET_BLACK(t, is_left ? NODE(t, sibling).lchild : NODE(t, sibling).rchild);
+				SET_RED(t, sibling);
+				rb_crotate(t, sibling, !is_left);
+				sibling = is_left ? NODE(t, parent).rchild : NODE(t, parent).lchild;
+				far = is_left ? NODE(t, sibling).rchild : NODE(t, sibling).lchild;
+			} /* Fall through */
+			/* Case 4: sibling black, "far" child red */
+			SET_COLOR(t, sibling, IS_RED(t, parent));
+			SET_BLACK(t, parent);
+			SET_BLACK(t, far);
+			rb_crotate(t, parent, is_left);
+			n = t->root;
+		}
+	}
+	if (n != RB_NIL) {
+		SET_BLACK(t, n);
+	}
+}
+
+
+
+
+/******************************************************************************
+ * Section 4: I/O
+ *****************************************************************************/
+/* Writes a tree to stdout in preorder format. */
+/* The walk uses the parent links instead of recursion. */
+void RBcompact_write(rb_compact t) {
+	rb_idx n = t->root;
+	int first = 1;
+	if (n == RB_NIL) {
+		fprintf(stderr, "Error: empty tree\n");
+		return;
+	}
+	while (n != RB_NIL) {
+		printf(first ? "%c, %d" : "; %c, %d", IS_RED(t, n) ? 'r' : 'b',
+			NODE(t, n).key);
+		first = 0;
+		if (NODE(t, n).lchild != RB_NIL) {
+			n = NODE(t, n).lchild;
+		} else if (NODE(t, n).rchild != RB_NIL) {
+			n = NODE(t, n).rchild;
+		} else {
+			/* Climb to the nearest right subtree we haven't done */
+			while (n != RB_NIL) {
+				rb_idx p = PARENT(t, n);
+				if (p != RB_NIL && n == NODE(t, p).lchild
+						&& NODE(t, p).rchild != RB_NIL) {
+					n = NODE(t, p).rchild;
+					break;
+				}
+				n = p;
+			}
+		}
+	}
+	putchar('\n');
+}
+/* Reads a tree in preorder format from file, or returns NULL if it's
+ * malformed. */
+/* The same scanner and checks as RBread, from RBload_priv.h. */
+rb_compact RBcompact_read(char *fname) {
+	rb_compact ret;
+	struct rb_scan s;
+	int failed = 0;
+	if ((s.fp = fopen(fname, "r")) == NULL) {
+		fprintf(stderr, "Error: couldn't read file %s.\n", fname);
+		return NULL;
+	}
+	if ((s.start = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		fclose(s.fp);
+		return NULL;
+	}
+	s.p = s.end = s.start;
+	s.fname = fname;
+	if ((ret = RBcompact_create()) != NULL) {
+		switch (rb_load_text(&rb_compact_load, ret, &s)) {
+		case RB_READ_FAILED:
+			failed = 1;
+			break;
+		case RB_READ_REPAIR:
+			failed = !rb_crebuild(ret);
+			break;
+		}
+		if (failed) {
+			RBcompact_free(ret);
+			ret = NULL;
+		}
+	}
+	free((char *)s.start);
+	fclose(s.fp);
+	return ret;
+}
+/* Helper routine: makes a node for rb_load_preorder. */
+static rb_load_node rb_cload_make(void *tree, int key, int red) {
+	rb_compact t = tree;
+	rb_idx n;
+	if ((n = rb_cnew(t, key)) != RB_NIL) {
+		SET_COLOR(t, n, red);
+		t->count++;
+	}
+	return n;
+}
+/* Helper routine: links a node for rb_load_preorder. */
+static void rb_cload_link(void *tree, rb_load_node parent, rb_load_node child,
+		int right) {
+	rb_compact t = tree;
+	rb_idx p = (rb_idx)parent, n = (rb_idx)child;
+	if (p == RB_NIL) {
+		SET_BLACK(t, n);
+		t->root = n;
+		return;
+	}
+	if (right) {
+		NODE(t, p).rchild = n;
+	} else {
+		NODE(t, p).lchild = n;
+	}
+	SET_PARENT(t, n, p);
+}
+/* Rebuilds a freshly read tree into a valid shape. */
+/* Repair is rare, so rather than a second copy of RBbuild_sorted's layout
+ * the keys are taken out in order and inserted again. Nothing has been
+ * deleted from a fresh tree, so they refill the same slots and the inserts
+ * can't fail. */
+static int rb_crebuild(rb_compact t) {
+	size_t count = t->count, i = 0;
+	rb_idx n = t->root, p;
+	int *keys;
+	if ((keys = malloc((count ? count : 1) * sizeof(*keys))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	/* In order along the parent links */
+	while (n != RB_NIL && NODE(t, n).lchild != RB_NIL) n = NODE(t, n).lchild;
+	while (n != RB_NIL) {
+		keys[i++] = NODE(t, n).key;
+		if (NODE(t, n).rchild != RB_NIL) {
+			n = NODE(t, n).rchild;
+			while (NODE(t, n).lchild != RB_NIL) n = NODE(t, n).lchild;
+		} else {
+			while ((p = PARENT(t, n)) != RB_NIL && n == NODE(t, p).rchild) {
+				n = p;
+			}
+			n = p;
+		}
+	}
+	t->root = RB_NIL;
+	t->len = 1;
+	t->count = 0;
+	for (i = 0; i < count; i++) {
+		RBcompact_insert(t, keys[i]);
+	}
+	free(keys);
+	return 1;
+}
+
+
+
+/******************************************************************************
+ * Section 5: Searching and general helper routines
+ *****************************************************************************/
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBcompact_search(rb_compact t, int key) {
+	rb_idx pos = t->root;
+	while (pos != RB_NIL) {
+		int k = NODE(t, pos).key;
+		if (k == key) {
+			return 1;
+		}
+		pos = (key < k) ? NODE(t, pos).lchild : NODE(t, pos).rchild;
+	}
+	return 0;
+}
+/* Returns the number of elements in the tree. */
+size_t RBcompact_size(rb_compact t) {
+	return t->count;
+}
+/* Returns the number of bytes the tree is using. */
+size_t RBcompact_memory(rb_compact t) {
+	return sizeof(*t) + (size_t)t->cap * sizeof(*t->nodes);
+}
+/* Rotates a tree around the given root. */
+static void rb_crotate(rb_compact t, rb_idx root, int go_left) {
+	rb_idx newroot = go_left ? NODE(t, root).rchild : NODE(t, root).lchild;
+	rb_idx parent = PARENT(t, root);
+	rb_idx middle;
+	/* We swap the center child and the old top node */
+	if (go_left) {
+		middle = NODE(t, newroot).lchild;
+		NODE(t, root).rchild = middle;
+		NODE(t, newroot).lchild = root;
+	} else {
+		middle = NODE(t, newroot).rchild;
+		NODE(t, root).lchild = middle;
+		NODE(t, newroot).rchild = root;
+	}
+	if (middle != RB_NIL) {
+		SET_PARENT(t, middle, root);
+	}
+	/* Now we set up the parent nodes */
+	SET_PARENT(t, newroot, parent);
+	SET_PARENT(t, root, newroot);
+	if (parent == RB_NIL) {
+		t->root = newroot;
+	} else if (NODE(t, parent).lchild == root) {
+		NODE(t, parent).lchild = newroot;
+	} else {
+		NODE(t, parent).rchild = newroot;
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef RBCOMPACT_H
+#define RBCOMPACT_H
+
+#include <stddef.h>
+
+/* A Red-Black tree of ints that stores its nodes in one array and links them
+ * by 32-bit index, with the color folded into the parent index. Each node is
+ * 16 bytes, against 40 for rb_tree. It holds at most 2^31 - 2 elements. */
+typedef struct rb_compact *rb_compact;
+
+/* Creates an empty compact tree. */
+rb_compact RBcompact_create();
+/* Frees an entire compact tree. */
+void RBcompact_free(rb_compact tree);
+
+/* Inserts an element with specified key into tree. */
+int RBcompact_insert(rb_compact tree, int key);
+/* Deletes an element with a particular key. */
+int RBcompact_delete(rb_compact tree, int key);
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBcompact_search(rb_compact tree, int key);
+/* Returns the number of elements in the tree. */
+size_t RBcompact_size(rb_compact tree);
+/* Returns the number of bytes the tree is using. */
+size_t RBcompact_memory(rb_compact tree);
+
+/* Writes a tree to stdout in preorder format, the same as RBwrite. */
+void RBcompact_write(rb_compact tree);
+/* Reads a tree in preorder format from file, the same as RBread: the keys
+ * must be in preorder, and a tree with bad colors or shape is rebuilt
+ * balanced. Returns NULL if the file is malformed or out of memory. */
+rb_compact RBcompact_read(char *fname);
+
+#endif /* RBCOMPACT_H */
@@ -0,0 +1,191 @@
+#include "RBfrozen.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __AVX2__
+#	include <immintrin.h>
+#endif
+
+/* The keys live in b[1..n]: b[1] is the root and node k has children 2k and
+ * 2k+1. Descending is then pure arithmetic on k, and the top levels of the
+ * tree, which every search touches, share a few cache lines. */
+struct rb_frozen {
+	size_t n;
+	int *b;
+};
+/* Cache line size, for aligning the array */
+#define RB_LINE 64
+/* Keys per cache line. Prefetching b[16k] fetches the line holding all 16 of
+ * k's great-great-grandchildren. */
+#define RB_LINE_KEYS (RB_LINE / sizeof(int))
+
+#if defined(__GNUC__)
+#	define rb_fprefetch(p) __builtin_prefetch(p)
+#	define rb_ffs(x) __builtin_ffsl(x)
+#else
+#	define rb_fprefetch(p) ((void)0)
+static int rb_ffs(long x) {
+	int i = 1;
+	if (x == 0) return 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		i++;
+	}
+	return i;
+}
+#endif
+
+/* Returns the index of the smallest key >= x, or 0 if there is none. */
+static size_t rb_frozen_lower_bound(rb_frozen fr, int x);
+/* Returns the index of the next key in order after index k, or 0. */
+static size_t rb_frozen_next(rb_frozen fr, size_t k);
+/* Returns the index of the first key in order. */
+static size_t rb_frozen_first(rb_frozen fr);
+
+
+/* Makes a frozen copy of a tree in O(n). */
+/* We walk the tree in order with a cursor and, in step with it, walk the
+ * Eytzinger indices in order, dropping each key into its slot. */
+rb_frozen RBfreeze(rb_tree tree) {
+	rb_frozen ret;
+	rb_cursor cur;
+	size_t n = 0, k, bytes;
+	if (RBfirst(tree, &cur)) {
+		do n++; while (RBnext(&cur));
+	}
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->n = n;
+	/* aligned_alloc wants a multiple of the alignment */
+	bytes = ((n + 1) * sizeof(int) + RB_LINE - 1) / RB_LINE * RB_LINE;
+	if ((ret->b = aligned_alloc(RB_LINE, bytes)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		free(ret);
+		return NULL;
+	}
+	ret->b[0] = 0;
+	if (n > 0) {
+		RBfirst(tree, &cur);
+		for (k = rb_frozen_first(ret); k != 0; k = rb_frozen_next(ret, k)) {
+			ret->b[k] = RBcursor_key(&cur);
+			RBnext(&cur);
+		}
+	}
+	return ret;
+}
+/* Frees a frozen tree. */
+void RBfrozen_free(rb_frozen fr) {
+	free(fr->b);
+	free(fr);
+}
+
+
+/* Returns nonzero if an element with the given key is present. */
+int RBfrozen_search(rb_frozen fr, int key) {
+	size_t k = rb_frozen_lower_bound(fr, key);
+	return k != 0 && fr->b[k] == key;
+}
+/* Looks up n keys at once. */
+size_t RBfrozen_search_many(rb_frozen fr, const int *keys, size_t n, int *out) {
+	size_t i = 0, found = 0;
+#ifdef __AVX2__
+	/* Eight searches at a time, one per 32-bit lane. A lane whose index
+	 * has run off the bottom of the tree stops moving; after as many
+	 * rounds as the tree has levels, every lane has. Indices must fit in
+	 * a signed 32-bit lane. */
+	if (fr->n < ((size_t)1 << 30)) {
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i limit = _mm256_set1_epi32((int)fr->n + 1);
+		int levels = 0, lvl, j;
+		int idx[8];
+		while (((size_t)1 << levels) <= fr->n) levels++;
+		for (; i + 8 <= n; i += 8) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(keys + i));
+			__m256i k = one;
+			for (lvl = 0; lvl < levels; lvl++) {
+				__m256i active = _mm256_cmpgt_epi32(limit, k);
+				__m256i v = _mm256_mask_i32gather_epi32(
+						_mm256_setzero_si256(), fr->b, k, active, 4);
+				__m256i lt = _mm256_and_si256(_mm256_cmpgt_epi32(x, v), active);
+				/* k = 2k + (b[k] < x) for the active lanes */
+				k = _mm256_sub_epi32(_mm256_add_epi32(k,
+						_mm256_and_si256(k, active)), lt);
+			}
+			_mm256_storeu_si256((__m256i *)idx, k);
+			for (j = 0; j < 8; j++) {
+				size_t kk = (size_t)idx[j] >> rb_ffs(~(long)idx[j]);
+				int hit = kk != 0 && fr->b[kk] == keys[i + j];
+				if (out != NULL) out[i + j] = hit;
+				found += hit;
+			}
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		int hit = RBfrozen_search(fr, keys[i]);
+		if (out != NULL) out[i] = hit;
+		found += hit;
+	}
+	return found;
+}
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. */
+size_t RBfrozen_range(rb_frozen fr, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg) {
+	size_t k, count = 0;
+	if (lo > hi) return 0;
+	for (k = rb_frozen_lower_bound(fr, lo); k != 0 && fr->b[k] <= hi;
+			k = rb_frozen_next(fr, k)) {
+		fn(fr->b[k], arg);
+		count++;
+	}
+	return count;
+}
+/* Copies up to max keys in [lo, hi] into out, in increasing order. */
+size_t RBfrozen_range_keys(rb_frozen fr, int lo, int hi, int *out, size_t max) {
+	size_t k, count = 0;
+	if (lo > hi) return 0;
+	for (k = rb_frozen_lower_bound(fr, lo); k != 0 && count < max
+			&& fr->b[k] <= hi; k = rb_frozen_next(fr, k)) {
+		out[count++] = fr->b[k];
+	}
+	return count;
+}
+/* Returns the number of elements. */
+size_t RBfrozen_size(rb_frozen fr) {
+	return fr->n;
+}
+
+
+/* Returns the index of the smallest key >= x, or 0 if there is none. */
+/* Go right (2k+1) past keys < x and left (2k) otherwise, until we fall off
+ * the bottom. The answer is where we last went left: strip the trailing right
+ * turns (1 bits) and the left turn (0 bit) before them. */
+static size_t rb_frozen_lower_bound(rb_frozen fr, int x) {
+	size_t k = 1;
+	while (k <= fr->n) {
+		rb_fprefetch(fr->b + k * RB_LINE_KEYS);
+		k = 2 * k + (fr->b[k] < x);
+	}
+	return k >> rb_ffs(~(long)k);
+}
+/* Returns the index of the next key in order after index k, or 0. */
+static size_t rb_frozen_next(rb_frozen fr, size_t k) {
+	if (2 * k + 1 <= fr->n) {
+		/* Leftmost node of the right subtree */
+		k = 2 * k + 1;
+		while (2 * k <= fr->n) k *= 2;
+		return k;
+	}
+	/* Climb out of right subtrees, then up once more */
+	while (k & 1) k >>= 1;
+	return k >> 1;
+}
+/* Returns the index of the first key in order. */
+static size_t rb_frozen_first(rb_frozen fr) {
+	size_t k = 1;
+	if (fr->n == 0) return 0;
+	while (2 * k <= fr->n) k *= 2;
+	return k;
+}
@@ -0,0 +1,31 @@
+#ifndef RBFROZEN_H
+#define RBFROZEN_H
+
+#include "RBtree.h"
+
+/* An immutable copy of a tree's keys, laid out for fast searching: one
+ * contiguous array in Eytzinger (breadth-first) order, searched without
+ * branches. A frozen tree never changes, so any number of threads may query
+ * it at once. */
+typedef struct rb_frozen *rb_frozen;
+
+/* Makes a frozen copy of a tree in O(n). The tree itself is not changed. */
+rb_frozen RBfreeze(rb_tree tree);
+/* Frees a frozen tree. */
+void RBfrozen_free(rb_frozen fr);
+
+/* Returns nonzero if an element with the given key is present. */
+int RBfrozen_search(rb_frozen fr, int key);
+/* Looks up n keys at once, like RBsearch_many. Uses AVX2 when the library is
+ * built with it (e.g. CFLAGS=-mavx2). */
+size_t RBfrozen_search_many(rb_frozen fr, const int *keys, size_t n, int *out);
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. Returns
+ * the number of keys visited. */
+size_t RBfrozen_range(rb_frozen fr, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg);
+/* Copies up to max keys in [lo, hi] into out, in increasing order. */
+size_t RBfrozen_range_keys(rb_frozen fr, int lo, int hi, int *out, size_t max);
+/* Returns the number of elements. */
+size_t RBfrozen_size(rb_frozen fr);
+
+#endif /* RBFROZEN_H */
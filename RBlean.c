@@ -0,0 +1,267 @@
+#include "RBlean.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct rb_lnode {
+	int key;
+	char color;
+	struct rb_lnode *link[2]; /* left and right child; NULL for none */
+} *rb_lnode;
+/* A chunk of nodes belonging to one tree */
+struct rb_lslab {
+	struct rb_lslab *next;
+	struct rb_lnode nodes[];
+};
+#define RB_LSLAB_NODES 1024
+/* A Red-Black tree of n nodes is at most 2*log2(n+1) high, which is 64 for any
+ * number of nodes a 32-bit key allows. A delete can push one extra node. */
+#define RB_LEAN_MAX_DEPTH 96
+
+struct rb_lean {
+	rb_lnode root;
+	size_t count;
+	/* Node arena, as in rb_tree */
+	struct rb_lslab *slabs;
+	rb_lnode bump, bump_end;
+	rb_lnode free_nodes; /* linked through link[0] */
+};
+
+/* Returns nonzero for a red node; NULL counts as black. */
+#define IS_RED(n) ((n) != NULL && (n)->color == 'r')
+
+/* Creates a new red node from the tree's arena. */
+static rb_lnode rb_lnew(rb_lean tree, int key);
+/* Gives a node back to the tree's arena. */
+static void rb_lfree(rb_lean tree, rb_lnode n);
+/* Rotates the subtree at root so that root moves down on side dir, and returns
+ * the new root of the subtree. The caller links it into root's old place. */
+static rb_lnode rb_lrotate(rb_lnode root, int dir);
+/* Links n in as child dir of path[depth-1], or as the root if depth is 0. */
+static void rb_lreplace(rb_lean tree, rb_lnode *path, int *dirs, int depth,
+		rb_lnode n);
+
+
+/* Creates an empty lean tree. */
+rb_lean RBlean_create() {
+	rb_lean ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->root = NULL;
+	ret->count = 0;
+	ret->slabs = NULL;
+	ret->bump = ret->bump_end = NULL;
+	ret->free_nodes = NULL;
+	return ret;
+}
+/* Frees an entire lean tree. */
+void RBlean_free(rb_lean tree) {
+	while (tree->slabs != NULL) {
+		struct rb_lslab *cur = tree->slabs;
+		tree->slabs = cur->next;
+		free(cur);
+	}
+	free(tree);
+}
+/* Creates a new red node from the tree's arena. */
+static rb_lnode rb_lnew(rb_lean tree, int key) {
+	rb_lnode ret;
+	if (tree->free_nodes != NULL) {
+		ret = tree->free_nodes;
+		tree->free_nodes = ret->link[0];
+	} else {
+		if (tree->bump == tree->bump_end) {
+			struct rb_lslab *slab = malloc(sizeof(*slab)
+					+ RB_LSLAB_NODES * sizeof(slab->nodes[0]));
+			if (slab == NULL) {
+				fprintf(stderr, "Error: out of memory.\n");
+				return NULL;
+			}
+			slab->next = tree->slabs;
+			tree->slabs = slab;
+			tree->bump = slab->nodes;
+			tree->bump_end = slab->nodes + RB_LSLAB_NODES;
+		}
+		ret = tree->bump++;
+	}
+	ret->key = key;
+	ret->color = 'r';
+	ret->link[0] = ret->link[1] = NULL;
+	return ret;
+}
+/* Gives a node back to the tree's arena. */
+static void rb_lfree(rb_lean tree, rb_lnode n) {
+	n->link[0] = tree->free_nodes;
+	tree->free_nodes = n;
+}
+
+
+/* Inserts an element with specified key into tree. */
+int RBlean_insert(rb_lean tree, int key) {
+	rb_lnode path[RB_LEAN_MAX_DEPTH]; /* nodes from the root down */
+	int dirs[RB_LEAN_MAX_DEPTH];      /* which child we took at each */
+	int depth = 0;
+	rb_lnode n = tree->root;
+	/* Locate the correct position, remembering the way */
+	while (n != NULL) {
+		if (key == n->key) {
+			fprintf(stderr, "Error: node %i already in the tree.\n", key);
+			return 0;
+		}
+		path[depth] = n;
+		dirs[depth] = key > n->key;
+		n = n->link[dirs[depth++]];
+	}
+	if ((n = rb_lnew(tree, key)) == NULL) {
+		return 0;
+	}
+	rb_lreplace(tree, path, dirs, depth, n);
+	tree->count++;
+	/* Fix the tree structure. n sits below path[depth-1]. */
+	while (depth >= 2 && IS_RED(path[depth-1])) {
+		rb_lnode p = path[depth-1], gp = path[depth-2];
+		int pdir = dirs[depth-2]; /* which side of gp p is on */
+		rb_lnode uncle = gp->link[!pdir];
+		/* Case 1: uncle is colored red */
+		if (IS_RED(uncle)) {
+			p->color = 'b';
+			uncle->color = 'b';
+			gp->color = 'r';
+			n = gp;
+			depth -= 2;
+			continue;
+		}
+		/* Case 2: node is "close to" uncle */
+		if (dirs[depth-1] != pdir) {
+			p = gp->link[pdir] = rb_lrotate(p, pdir);
+		} /* Fall through */
+		/* Case 3: node is "far from" uncle */
+		p->color = 'b';
+		gp->color = 'r';
+		rb_lreplace(tree, path, dirs, depth - 2, rb_lrotate(gp, !pdir));
+		break;
+	}
+	tree->root->color = 'b';
+	return 1;
+}
+
+
+/* Deletes an element with a particular key. */
+int RBlean_delete(rb_lean tree, int key) {
+	rb_lnode path[RB_LEAN_MAX_DEPTH];
+	int dirs[RB_LEAN_MAX_DEPTH];
+	int depth = 0;
+	rb_lnode dead = tree->root, child;
+	/* Find the node, remembering the way */
+	while (dead != NULL && dead->key != key) {
+		path[depth] = dead;
+		dirs[depth] = key > dead->key;
+		dead = dead->link[dirs[depth++]];
+	}
+	if (dead == NULL) {
+		fprintf(stderr, "Error: node %i does not exist.\n", key);
+		return 0;
+	}
+	/* With two children, take the successor's key and delete the
+	 * successor instead, which has no left child. */
+	if (dead->link[0] != NULL && dead->link[1] != NULL) {
+		rb_lnode successor = dead->link[1];
+		path[depth] = dead;
+		dirs[depth++] = 1;
+		while (successor->link[0] != NULL) {
+			path[depth] = successor;
+			dirs[depth++] = 0;
+			successor = successor->link[0];
+		}
+		dead->key = successor->key;
+		dead = successor;
+	}
+	child = (dead->link[0] != NULL) ? dead->link[0] : dead->link[1];
+	rb_lreplace(tree, path, dirs, depth, child);
+	tree->count--;
+	/* Removing a red node, or a black one with a red child we can turn
+	 * black, leaves the black heights alone. */
+	if (dead->color == 'r' || IS_RED(child)) {
+		if (child != NULL) child->color = 'b';
+		rb_lfree(tree, dead);
+		return 1;
+	}
+	rb_lfree(tree, dead);
+	/* Otherwise the subtree at child dirs[depth-1] of path[depth-1] is one
+	 * black short. Walk that shortage up the path. */
+	while (depth > 0) {
+		rb_lnode p = path[depth-1];
+		int dir = dirs[depth-1];
+		rb_lnode sibling = p->link[!dir];
+		/* Case 1: sibling red. Rotate it above p, which pushes p
+		 * one step down the path. */
+		if (IS_RED(sibling)) {
+			sibling->color = 'b';
+			p->color = 'r';
+			rb_lreplace(tree, path, dirs, depth - 1, rb_lrotate(p, dir));
+			path[depth-1] = sibling;
+			dirs[depth-1] = dir;
+			path[depth] = p;
+			dirs[depth] = dir;
+			depth++;
+			sibling = p->link[!dir];
+		}
+		/* Case 2: sibling black, both sibling's children black */
+		if (!IS_RED(sibling->link[0]) && !IS_RED(sibling->link[1])) {
+			sibling->color = 'r';
+			if (p->color == 'r') {
+				p->color = 'b';
+				return 1;
+			}
+			depth--;
+			continue;
+		}
+		/* Case 3: sibling black, "far" child black */
+		if (!IS_RED(sibling->link[!dir])) {
+			sibling->link[dir]->color = 'b';
+			sibling->color = 'r';
+			sibling = p->link[!dir] = rb_lrotate(sibling, !dir);
+		} /* Fall through */
+		/* Case 4: sibling black, "far" child red */
+		sibling->color = p->color;
+		p->color = 'b';
+		sibling->link[!dir]->color = 'b';
+		rb_lreplace(tree, path, dirs, depth - 1, rb_lrotate(p, dir));
+		return 1;
+	}
+	return 1;
+}
+
+
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBlean_search(rb_lean tree, int key) {
+	rb_lnode n = tree->root;
+	while (n != NULL) {
+		if (key == n->key) {
+			return 1;
+		}
+		n = n->link[key > n->key];
+	}
+	return 0;
+}
+/* Returns the number of elements in the tree. */
+size_t RBlean_size(rb_lean tree) {
+	return tree->count;
+}
+/* Rotates the subtree at root so that root moves down on side dir. */
+static rb_lnode rb_lrotate(rb_lnode root, int dir) {
+	rb_lnode newroot = root->link[!dir];
+	root->link[!dir] = newroot->link[dir];
+	newroot->link[dir] = root;
+	return newroot;
+}
+/* Links n in as child dir of path[depth-1], or as the root if depth is 0. */
+static void rb_lreplace(rb_lean tree, rb_lnode *path, int *dirs, int depth,
+		rb_lnode n) {
+	if (depth == 0) {
+		tree->root = n;
+	} else {
+		path[depth-1]->link[dirs[depth-1]] = n;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef RBLEAN_H
+#define RBLEAN_H
+
+#include <stddef.h>
+
+/* A Red-Black tree of ints whose nodes have no parent pointer. Insertion and
+ * deletion remember the path they took down in a small fixed-size stack and
+ * fix the tree up along it, so rotations only rewrite child links. Each node
+ * is 24 bytes, against 40 for rb_tree. */
+typedef struct rb_lean *rb_lean;
+
+/* Creates an empty lean tree. */
+rb_lean RBlean_create();
+/* Frees an entire lean tree. */
+void RBlean_free(rb_lean tree);
+
+/* Inserts an element with specified key into tree. */
+int RBlean_insert(rb_lean tree, int key);
+/* Deletes an element with a particular key. */
+int RBlean_delete(rb_lean tree, int key);
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBlean_search(rb_lean tree, int key);
+/* Returns the number of elements in the tree. */
+size_t RBlean_size(rb_lean tree);
+
+#endif /* RBLEAN_H */
@@ -0,0 +1,279 @@
+#ifndef RBLOAD_PRIV_H
+#define RBLOAD_PRIV_H
+
+/* Loading trees from preorder, shared by rb_tree's loaders and by
+ * RBcompact_read. The scanner reads the text format and the preorder builder
+ * links up and checks nodes from any source; the tree itself is reached only
+ * through a struct rb_load_ops. Everything here is static, so each loader
+ * gets its own copy without a library to link. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+/* A node of the tree being loaded, as the tree names it (a pointer or an
+ * index); 0 means no node. */
+typedef uintptr_t rb_load_node;
+/* How the preorder builder makes and links the nodes of a tree */
+struct rb_load_ops {
+	/* Makes a node, or returns 0 if out of memory. */
+	rb_load_node (*make)(void *tree, int key, int red);
+	/* Makes child the right (or left) child of parent. With no parent,
+	 * makes child the root and colors it black. */
+	void (*link)(void *tree, rb_load_node parent, rb_load_node child,
+		int right);
+};
+/* Builds a tree from nodes in preorder, whose keys and colors come from
+ * next(src, &key, &red) until it returns 0. Returns RB_READ_OK,
+ * RB_READ_REPAIR if the keys are in order but the colors or shape are not a
+ * valid Red-Black tree, RB_READ_UNORDERED if the keys can't be the preorder
+ * of a search tree, or RB_READ_FAILED if we ran out of memory. */
+static int rb_load_preorder(const struct rb_load_ops *ops, void *tree,
+		int (*next)(void *src, int *key, int *red), void *src);
+#define RB_READ_OK        0
+#define RB_READ_REPAIR    1
+#define RB_READ_UNORDERED 2
+#define RB_READ_FAILED    3
+/* A node whose right subtree is still open during rb_load_preorder */
+struct rb_load_frame {
+	rb_load_node n;
+	int key;
+	int low;       /* keys below n must be above this... */
+	int has_low;   /* ...if set */
+	int red;
+	int black;     /* black nodes from the root down to n */
+};
+
+/* Size of the I/O buffers */
+#define RB_IO_BUF (1 << 20)
+/* A text input, either read through a buffer or mapped whole */
+struct rb_scan {
+	const char *p, *end;  /* unread input */
+	const char *start;    /* the buffer, or the whole mapped file */
+	FILE *fp;             /* NULL when mapped */
+	char *fname;          /* for error messages */
+	size_t base;          /* file offset of start */
+	size_t line;          /* current line number, from 1 */
+	size_t line_start;    /* file offset at which it starts */
+	int failed;
+};
+/* Returns the next input character without taking it, or EOF. */
+#define rb_scan_peek(s) \
+	((s)->p < (s)->end ? (unsigned char)*(s)->p : rb_scan_fill(s))
+/* Builds a tree from the text in s with rb_load_preorder. Returns as it does,
+ * except that malformed text is reported and returns RB_READ_FAILED. */
+static int rb_load_text(const struct rb_load_ops *ops, void *tree,
+		struct rb_scan *s);
+/* Helper routine: reads a single node's key and color from struct rb_scan
+ * *src. Returns 0 at the end of the input or if the text is malformed. */
+static int rb_scan_node(void *src, int *key, int *red);
+/* Refills the buffer and returns the next character, or EOF. */
+static int rb_scan_fill(struct rb_scan *s);
+/* Skips whitespace, counting lines. */
+static void rb_scan_space(struct rb_scan *s);
+/* Reports malformed input at file offset off. */
+static void rb_scan_error(struct rb_scan *s, size_t off, char *what);
+
+
+/* Builds a tree from nodes in preorder. */
+/* Each node is either the left child of the node before it, or the right
+ * child of the nearest node above whose key is smaller and whose right
+ * subtree isn't started yet. Those nodes are kept on a stack, so a node costs
+ * O(1) amortized and nothing recurses, however deep the input. On the way we
+ * check each key against the bounds its place gives it, look for a red node
+ * under a red one, and compare the black count at every empty child slot. */
+static int rb_load_preorder(const struct rb_load_ops *ops, void *tree,
+		int (*next)(void *src, int *key, int *red), void *src) {
+	struct rb_load_frame *stack, *tmp, top;
+	size_t sp = 0, cap = 64;
+	rb_load_node n;
+	int key, red, low, has_low;
+	int black = -1; /* black count every empty slot must have */
+	int ret = RB_READ_OK;
+	/* An empty slot below f; check its black count */
+#define RB_LOAD_LEAF(f) do { \
+		if (black < 0) black = (f).black; \
+		else if ((f).black != black) ret = RB_READ_REPAIR; \
+	} while (0)
+	if (!next(src, &key, &red)) {
+		return RB_READ_OK;
+	}
+	if ((n = ops->make(tree, key, red)) == 0) {
+		return RB_READ_FAILED;
+	}
+	if ((stack = malloc(cap * sizeof(*stack))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return RB_READ_FAILED;
+	}
+	/* The root may always be made black, so it counts as black */
+	ops->link(tree, 0, n, 0);
+	stack[sp].n = n;
+	stack[sp].key = key;
+	stack[sp].has_low = 0;
+	stack[sp].red = 0;
+	stack[sp++].black = 1;
+	while (next(src, &key, &red)) {
+		top = stack[sp-1];
+		if (key < top.key) {
+			if (top.has_low && key <= top.low) {
+				ret = RB_READ_UNORDERED;
+				break;
+			}
+			low = top.low;
+			has_low = top.has_low;
+		} else {
+			/* top gets no left child. Pop the nodes below the new
+			 * one; the last takes it as right child and the rest
+			 * get none. */
+			RB_LOAD_LEAF(top);
+			sp--;
+			while (sp > 0 && stack[sp-1].key < key) {
+				RB_LOAD_LEAF(top);
+				top = stack[--sp];
+			}
+			if (top.key == key || (sp > 0 && stack[sp-1].key == key)) {
+				ret = RB_READ_UNORDERED;
+				break;
+			}
+			low = top.key;
+			has_low = 1;
+		}
+		if ((n = ops->make(tree, key, red)) == 0) {
+			ret = RB_READ_FAILED;
+			break;
+		}
+		ops->link(tree, top.n, n, key > top.key);
+		if (red && top.red) {
+			ret = RB_READ_REPAIR;
+		}
+		if (sp == cap) {
+			if ((tmp = realloc(stack, 2 * cap * sizeof(*stack))) == NULL) {
+				fprintf(stderr, "Error: out of memory.\n");
+				ret = RB_READ_FAILED;
+				break;
+			}
+			stack = tmp;
+			cap *= 2;
+		}
+		stack[sp].n = n;
+		stack[sp].key = key;
+		stack[sp].low = low;
+		stack[sp].has_low = has_low;
+		stack[sp].red = red;
+		/* Either way, top is now the parent's frame */
+		stack[sp++].black = top.black + !red;
+	}
+	if (ret <= RB_READ_REPAIR) {
+		/* The last node has no left child, and nothing on the stack
+		 * has a right child */
+		RB_LOAD_LEAF(stack[sp-1]);
+		while (sp > 0) {
+			RB_LOAD_LEAF(stack[sp-1]);
+			sp--;
+		}
+	}
+#undef RB_LOAD_LEAF
+	free(stack);
+	return ret;
+}
+/* Builds a tree from the text in s. */
+static int rb_load_text(const struct rb_load_ops *ops, void *tree,
+		struct rb_scan *s) {
+	int ret;
+	s->base = 0;
+	s->line = 1;
+	s->line_start = 0;
+	s->failed = 0;
+	ret = rb_load_preorder(ops, tree, rb_scan_node, s);
+	if (ret == RB_READ_UNORDERED) {
+		fprintf(stderr, "Error: %s:%lu: keys are not in preorder.\n",
+			s->fname, (unsigned long)s->line);
+	}
+	if (ret != RB_READ_OK && ret != RB_READ_REPAIR) {
+		return RB_READ_FAILED;
+	}
+	return s->failed ? RB_READ_FAILED : ret;
+}
+/* Helper routine: reads a single node's key and color from struct rb_scan
+ * *src. */
+/* A node is an optional semicolon, a color, a comma and a key, with
+ * whitespace allowed between any of them. */
+static int rb_scan_node(void *src, int *key, int *red) {
+	struct rb_scan *s = src;
+	unsigned long data = 0, limit = INT_MAX; /* the data of the node */
+	size_t off;            /* where the key starts */
+	int c, neg = 0;
+	if (s->failed) return 0;
+	rb_scan_space(s);
+	if (rb_scan_peek(s) == ';') {
+		s->p++;
+		rb_scan_space(s);
+	}
+	if ((c = rb_scan_peek(s)) == EOF) {
+		return 0;
+	}
+	if (c != 'b' && c != 'r') {
+		rb_scan_error(s, s->base + (s->p - s->start), "expected 'b' or 'r'");
+		return 0;
+	}
+	*red = (c == 'r');
+	s->p++;
+	rb_scan_space(s);
+	if (rb_scan_peek(s) != ',') {
+		rb_scan_error(s, s->base + (s->p - s->start), "expected ','");
+		return 0;
+	}
+	s->p++;
+	rb_scan_space(s);
+	off = s->base + (s->p - s->start);
+	if ((c = rb_scan_peek(s)) == '-' || c == '+') {
+		neg = (c == '-');
+		limit += neg;
+		s->p++;
+	}
+	if ((c = rb_scan_peek(s)) < '0' || c > '9') {
+		rb_scan_error(s, s->base + (s->p - s->start), "expected a number");
+		return 0;
+	}
+	do {
+		data = data * 10 + (c - '0');
+		if (data > limit) {
+			rb_scan_error(s, off, "number out of range");
+			return 0;
+		}
+		s->p++;
+	} while ((c = rb_scan_peek(s)) >= '0' && c <= '9');
+	*key = neg ? (int)(0u - (unsigned int)data) : (int)data;
+	return 1;
+}
+/* Refills the buffer and returns the next character, or EOF. */
+static int rb_scan_fill(struct rb_scan *s) {
+	size_t got;
+	if (s->fp == NULL) return EOF;
+	s->base += s->end - s->start;
+	got = fread((char *)s->start, 1, RB_IO_BUF, s->fp);
+	s->p = s->start;
+	s->end = s->start + got;
+	return (got > 0) ? (unsigned char)*s->p : EOF;
+}
+/* Skips whitespace, counting lines. */
+static void rb_scan_space(struct rb_scan *s) {
+	int c;
+	while ((c = rb_scan_peek(s)) == ' ' || c == '\n' || c == '\t' || c == '\r'
+			|| c == '\v' || c == '\f') {
+		s->p++;
+		if (c == '\n') {
+			s->line++;
+			s->line_start = s->base + (s->p - s->start);
+		}
+	}
+}
+/* Reports malformed input at file offset off. */
+static void rb_scan_error(struct rb_scan *s, size_t off, char *what) {
+	fprintf(stderr, "Error: %s:%lu:%lu: %s.\n", s->fname,
+		(unsigned long)s->line, (unsigned long)(off - s->line_start + 1), what);
+	s->failed = 1;
+}
+
+#endif /* RBLOAD_PRIV_H */
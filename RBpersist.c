@@ -0,0 +1,445 @@
+#include "RBpersist.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+typedef struct rb_pnode {
+	int key;
+	atomic_uint refs; /* links and snapshots pointing here */
+	char color;
+	struct rb_pnode *link[2]; /* left and right child; NULL for none */
+} *rb_pnode;
+/* As in rb_lean. Every version is a Red-Black tree, so this also bounds the
+ * stack needed to walk or free one. */
+#define RB_PERSIST_MAX_DEPTH 96
+
+struct rb_persist {
+	rb_pnode root; /* holds a reference to the root */
+	size_t count;
+	rb_pnode spare; /* nodes set aside for copies, linked through link[0] */
+	int spares;
+};
+struct rb_version {
+	rb_pnode root; /* holds a reference to the root */
+	size_t count;
+};
+
+/* Returns nonzero for a red node; NULL counts as black. */
+#define IS_RED(n) ((n) != NULL && (n)->color == 'r')
+
+/* Creates a new red node, held once. */
+static rb_pnode rb_pnew(int key);
+/* Drops one reference to n, freeing it and dropping its children's
+ * references if that was the last. */
+static void rb_pdrop(rb_pnode n);
+/* Sets aside enough spare nodes for need copies. Returns 0 if out of memory. */
+static int rb_preserve(rb_persist tree, int need);
+/* Makes child dir of parent (or the root, if parent is NULL) safe to change:
+ * if another version shares it, puts a copy in its place. The parent must be
+ * the live tree's alone. Returns the child. */
+static rb_pnode rb_pown(rb_persist tree, rb_pnode parent, int dir);
+/* Owns, top-down, each node on a path found by a search. */
+static void rb_pown_path(rb_persist tree, rb_pnode *path, int *dirs, int depth);
+/* Copies a shared node into a spare one. The copy adds a link to each child
+ * but child skip. */
+static rb_pnode rb_pcopy(rb_persist tree, rb_pnode n, int skip);
+/* Rotates the subtree at root so that root moves down on side dir, and returns
+ * the new root of the subtree. The caller links it into root's old place. */
+static rb_pnode rb_protate(rb_pnode root, int dir);
+/* Links n in as child dir of path[depth-1], or as the root if depth is 0. */
+static void rb_preplace(rb_persist tree, rb_pnode *path, int *dirs, int depth,
+		rb_pnode n);
+/* Returns nonzero if key is in the version rooted at n. */
+static int rb_psearch(rb_pnode n, int key);
+
+
+/* Creates an empty persistent tree. */
+rb_persist RBpersist_create() {
+	rb_persist ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->root = NULL;
+	ret->count = 0;
+	ret->spare = NULL;
+	ret->spares = 0;
+	return ret;
+}
+/* Frees the live tree. Snapshots taken from it stay valid. */
+void RBpersist_free(rb_persist tree) {
+	rb_pnode n;
+	rb_pdrop(tree->root);
+	while ((n = tree->spare) != NULL) {
+		tree->spare = n->link[0];
+		free(n);
+	}
+	free(tree);
+}
+/* Creates a new red node, held once. */
+/* Nodes come from malloc one at a time rather than from a per-tree arena:
+ * a snapshot may outlive its tree, and be released on another thread. */
+static rb_pnode rb_pnew(int key) {
+	rb_pnode ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->key = key;
+	atomic_init(&ret->refs, 1);
+	ret->color = 'r';
+	ret->link[0] = ret->link[1] = NULL;
+	return ret;
+}
+/* Drops one reference to n, freeing it and dropping its children's
+ * references if that was the last. */
+/* A dead node's subtree is no deeper than the version it was in, so the
+ * right children waiting their turn fit in a fixed stack. */
+static void rb_pdrop(rb_pnode n) {
+	rb_pnode stack[RB_PERSIST_MAX_DEPTH];
+	int depth = 0;
+	for (;;) {
+		if (n != NULL && atomic_fetch_sub(&n->refs, 1) == 1) {
+			rb_pnode left = n->link[0];
+			stack[depth++] = n->link[1];
+			free(n);
+			n = left;
+		} else if (depth > 0) {
+			n = stack[--depth];
+		} else {
+			return;
+		}
+	}
+}
+/* Sets aside enough spare nodes for need copies. */
+/* A write can't stop partway through a fixup, and changing a shared node would
+ * change the snapshots too, so the copies it might make are allocated before
+ * it changes anything. Spares it doesn't use are kept for the next write. */
+static int rb_preserve(rb_persist tree, int need) {
+	rb_pnode n;
+	while (tree->spares < need) {
+		if ((n = rb_pnew(0)) == NULL) {
+			return 0;
+		}
+		n->link[0] = tree->spare;
+		tree->spare = n;
+		tree->spares++;
+	}
+	return 1;
+}
+
+
+/* Returns a read-only view of the tree as it is now, in O(1). */
+rb_version RBsnapshot(rb_persist tree) {
+	rb_version ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->root = tree->root;
+	ret->count = tree->count;
+	if (ret->root != NULL) {
+		atomic_fetch_add(&ret->root->refs, 1);
+	}
+	return ret;
+}
+/* Gives up a snapshot, freeing the nodes no other version holds. */
+void RBversion_release(rb_version v) {
+	rb_pdrop(v->root);
+	free(v);
+}
+/* Makes child dir of parent (or the root) safe to change. */
+/* A node is the live tree's alone when its parent is and nothing else links
+ * to it. A reader that released its last other reference did so with a
+ * full barrier, so its reads are over before this load sees the count. */
+static rb_pnode rb_pown(rb_persist tree, rb_pnode parent, int dir) {
+	rb_pnode *slot = (parent == NULL) ? &tree->root : &parent->link[dir];
+	rb_pnode n = *slot;
+	if (n == NULL || atomic_load(&n->refs) == 1) {
+		return n;
+	}
+	*slot = rb_pcopy(tree, n, -1);
+	/* The last snapshot holding n may have gone since the load above */
+	rb_pdrop(n);
+	return *slot;
+}
+/* Owns, top-down, each node on a path found by a search. */
+/* Below a copied node the rest of the path is shared too, since the old
+ * node still links to it. Each copy skips counting the link to its child on
+ * the path, which the next copy replaces at once, so the path's counts are
+ * left as they were and only the children off the path gain a link. */
+static void rb_pown_path(rb_persist tree, rb_pnode *path, int *dirs, int depth) {
+	rb_pnode old = NULL; /* the first node copied */
+	int i;
+	for (i = 0; i < depth; i++) {
+		int skip = (i + 1 < depth) ? dirs[i] : -1;
+		if (old != NULL) {
+			/* path[i-1] is a copy whose link here is uncounted */
+			path[i-1]->link[dirs[i-1]] = path[i] = rb_pcopy(tree, path[i], skip);
+		} else if (atomic_load(&path[i]->refs) != 1) {
+			old = path[i];
+			path[i] = rb_pcopy(tree, old, skip);
+			rb_preplace(tree, path, dirs, i, path[i]);
+		}
+	}
+	/* Let go of the old path only now: if the last snapshot holding it has
+	 * gone meanwhile, freeing it drops the counted links below it. */
+	rb_pdrop(old);
+}
+/* Copies a shared node into a spare one. The copy adds a link to each child
+ * but child skip. */
+/* The caller has reserved the spare, so this can't fail. */
+static rb_pnode rb_pcopy(rb_persist tree, rb_pnode n, int skip) {
+	rb_pnode copy = tree->spare;
+	tree->spare = copy->link[0];
+	tree->spares--;
+	copy->key = n->key;
+	atomic_store(&copy->refs, 1);
+	copy->color = n->color;
+	copy->link[0] = n->link[0];
+	copy->link[1] = n->link[1];
+	if (copy->link[0] != NULL && skip != 0) {
+		atomic_fetch_add(&copy->link[0]->refs, 1);
+	}
+	if (copy->link[1] != NULL && skip != 1) {
+		atomic_fetch_add(&copy->link[1]->refs, 1);
+	}
+	return copy;
+}
+
+
+/* Inserts an element with specified key into tree. */
+int RBpersist_insert(rb_persist tree, int key) {
+	rb_pnode path[RB_PERSIST_MAX_DEPTH]; /* nodes from the root down */
+	int dirs[RB_PERSIST_MAX_DEPTH];      /* which child we took at each */
+	int depth = 0;
+	rb_pnode n = tree->root;
+	/* Locate the correct position, remembering the way */
+	while (n != NULL) {
+		if (key == n->key) {
+			fprintf(stderr, "Error: node %i already in the tree.\n", key);
+			return 0;
+		}
+		path[depth] = n;
+		dirs[depth] = key > n->key;
+		n = n->link[dirs[depth++]];
+	}
+	/* Copies go to the path, and to at most one uncle for every two levels
+	 * the fixup climbs */
+	if (!rb_preserve(tree, depth + depth / 2) || (n = rb_pnew(key)) == NULL) {
+		return 0;
+	}
+	/* Only now that the insert will happen, copy the shared part of the
+	 * way down */
+	rb_pown_path(tree, path, dirs, depth);
+	rb_preplace(tree, path, dirs, depth, n);
+	tree->count++;
+	/* Fix the tree structure as rb_lean does. The path is ours; the uncle
+	 * is the only other node a fixup changes. */
+	while (depth >= 2 && IS_RED(path[depth-1])) {
+		rb_pnode p = path[depth-1], gp = path[depth-2];
+		int pdir = dirs[depth-2]; /* which side of gp p is on */
+		rb_pnode uncle = gp->link[!pdir];
+		/* Case 1: uncle is colored red */
+		if (IS_RED(uncle)) {
+			uncle = rb_pown(tree, gp, !pdir);
+			p->color = 'b';
+			uncle->color = 'b';
+			gp->color = 'r';
+			n = gp;
+			depth -= 2;
+			continue;
+		}
+		/* Case 2: node is "close to" uncle */
+		if (dirs[depth-1] != pdir) {
+			p = gp->link[pdir] = rb_protate(p, pdir);
+		} /* Fall through */
+		/* Case 3: node is "far from" uncle */
+		p->color = 'b';
+		gp->color = 'r';
+		rb_preplace(tree, path, dirs, depth - 2, rb_protate(gp, !pdir));
+		break;
+	}
+	tree->root->color = 'b';
+	return 1;
+}
+
+
+/* Deletes an element with a particular key. */
+int RBpersist_delete(rb_persist tree, int key) {
+	rb_pnode path[RB_PERSIST_MAX_DEPTH];
+	int dirs[RB_PERSIST_MAX_DEPTH];
+	int depth = 0, found;
+	rb_pnode dead = tree->root, child;
+	/* Find the node, remembering the way */
+	while (dead != NULL && dead->key != key) {
+		path[depth] = dead;
+		dirs[depth] = key > dead->key;
+		dead = dead->link[dirs[depth++]];
+	}
+	if (dead == NULL) {
+		fprintf(stderr, "Error: node %i does not exist.\n", key);
+		return 0;
+	}
+	/* With two children, the successor is the node that goes, and its key
+	 * moves up into the found one. Keep walking, so the found node is on
+	 * the path and gets owned along with the rest of it. */
+	found = -1;
+	if (dead->link[0] != NULL && dead->link[1] != NULL) {
+		found = depth;
+		path[depth] = dead;
+		dirs[depth++] = 1;
+		dead = dead->link[1];
+		while (dead->link[0] != NULL) {
+			path[depth] = dead;
+			dirs[depth++] = 0;
+			dead = dead->link[0];
+		}
+	}
+	/* Copies go to the path, to a sibling at each level the fixup climbs,
+	 * and to at most one more sibling and two nephews where it stops */
+	if (!rb_preserve(tree, 2 * depth + 3)) {
+		return 0;
+	}
+	rb_pown_path(tree, path, dirs, depth);
+	if (found >= 0) {
+		path[found]->key = dead->key;
+	}
+	/* dead itself is not changed, only unlinked, so it need not be owned.
+	 * Its child gains a link from dead's parent before dead lets go. */
+	child = (dead->link[0] != NULL) ? dead->link[0] : dead->link[1];
+	if (child != NULL) {
+		atomic_fetch_add(&child->refs, 1);
+	}
+	rb_preplace(tree, path, dirs, depth, child);
+	tree->count--;
+	/* Removing a red node, or a black one with a red child we can turn
+	 * black, leaves the black heights alone. */
+	if (dead->color == 'r' || IS_RED(child)) {
+		rb_pdrop(dead);
+		if (child != NULL) {
+			child = rb_pown(tree, depth > 0 ? path[depth-1] : NULL,
+				depth > 0 ? dirs[depth-1] : 0);
+			child->color = 'b';
+		}
+		return 1;
+	}
+	rb_pdrop(dead);
+	/* Otherwise the subtree at child dirs[depth-1] of path[depth-1] is one
+	 * black short. Walk that shortage up the path, owning the sibling and
+	 * nephews before changing them. */
+	while (depth > 0) {
+		rb_pnode p = path[depth-1];
+		int dir = dirs[depth-1];
+		rb_pnode sibling = rb_pown(tree, p, !dir);
+		/* Case 1: sibling red. Rotate it above p, which pushes p
+		 * one step down the path. */
+		if (IS_RED(sibling)) {
+			sibling->color = 'b';
+			p->color = 'r';
+			rb_preplace(tree, path, dirs, depth - 1, rb_protate(p, dir));
+			path[depth-1] = sibling;
+			dirs[depth-1] = dir;
+			path[depth] = p;
+			dirs[depth] = dir;
+			depth++;
+			sibling = rb_pown(tree, p, !dir);
+		}
+		/* Case 2: sibling black, both sibling's children black */
+		if (!IS_RED(sibling->link[0]) && !IS_RED(sibling->link[1])) {
+			sibling->color = 'r';
+			if (p->color == 'r') {
+				p->color = 'b';
+				return 1;
+			}
+			depth--;
+			continue;
+		}
+		/* Case 3: sibling black, "far" child black */
+		if (!IS_RED(sibling->link[!dir])) {
+			rb_pown(tree, sibling, dir)->color = 'b';
+			sibling->color = 'r';
+			sibling = p->link[!dir] = rb_protate(sibling, !dir);
+		} /* Fall through */
+		/* Case 4: sibling black, "far" child red */
+		sibling->color = p->color;
+		p->color = 'b';
+		rb_pown(tree, sibling, !dir)->color = 'b';
+		rb_preplace(tree, path, dirs, depth - 1, rb_protate(p, dir));
+		return 1;
+	}
+	return 1;
+}
+
+
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBpersist_search(rb_persist tree, int key) {
+	return rb_psearch(tree->root, key);
+}
+/* Returns the number of elements in the tree. */
+size_t RBpersist_size(rb_persist tree) {
+	return tree->count;
+}
+/* Returns nonzero if an element with the given key is in the snapshot. */
+int RBversion_search(rb_version v, int key) {
+	return rb_psearch(v->root, key);
+}
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. */
+size_t RBversion_range(rb_version v, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg) {
+	rb_pnode stack[RB_PERSIST_MAX_DEPTH];
+	int depth = 0;
+	size_t count = 0;
+	rb_pnode n = v->root;
+	if (lo > hi) return 0;
+	for (;;) {
+		/* Stack the keys >= lo on the way down to the smallest one */
+		while (n != NULL) {
+			if (n->key >= lo) {
+				stack[depth++] = n;
+				n = n->link[0];
+			} else {
+				n = n->link[1];
+			}
+		}
+		if (depth == 0) break;
+		n = stack[--depth];
+		if (n->key > hi) break;
+		fn(n->key, arg);
+		count++;
+		n = n->link[1];
+	}
+	return count;
+}
+/* Returns the number of elements in the snapshot. */
+size_t RBversion_size(rb_version v) {
+	return v->count;
+}
+/* Returns nonzero if key is in the version rooted at n. */
+static int rb_psearch(rb_pnode n, int key) {
+	while (n != NULL) {
+		if (key == n->key) {
+			return 1;
+		}
+		n = n->link[key > n->key];
+	}
+	return 0;
+}
+/* Rotates the subtree at root so that root moves down on side dir. */
+/* Only root's and the new root's links change, and every child keeps exactly
+ * one link from this version, so no counts move. */
+static rb_pnode rb_protate(rb_pnode root, int dir) {
+	rb_pnode newroot = root->link[!dir];
+	root->link[!dir] = newroot->link[dir];
+	newroot->link[dir] = root;
+	return newroot;
+}
+/* Links n in as child dir of path[depth-1], or as the root if depth is 0. */
+static void rb_preplace(rb_persist tree, rb_pnode *path, int *dirs, int depth,
+		rb_pnode n) {
+	if (depth == 0) {
+		tree->root = n;
+	} else {
+		path[depth-1]->link[dirs[depth-1]] = n;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef RBPERSIST_H
+#define RBPERSIST_H
+
+#include <stddef.h>
+
+/* A Red-Black tree of ints that keeps old versions around. Like rb_lean, its
+ * nodes have no parent pointers, so a node can sit in several versions at
+ * once. Nodes count the links and snapshots that point at them; an insert or
+ * delete copies only the shared nodes it would change (the path down from the
+ * root, plus any sibling or nephew a fixup recolors or rotates) and changes
+ * unshared nodes in place. With no snapshot alive it costs little more than
+ * rb_lean.
+ *
+ * One thread writes a tree and takes its snapshots. A snapshot never changes,
+ * so it may be handed to and read by any number of threads, and released by
+ * any one of them. Nodes are freed when the last version holding them goes. */
+typedef struct rb_persist *rb_persist;
+typedef struct rb_version *rb_version;
+
+/* Creates an empty persistent tree. */
+rb_persist RBpersist_create();
+/* Frees the live tree. Snapshots taken from it stay valid. */
+void RBpersist_free(rb_persist tree);
+
+/* Inserts an element with specified key into tree. */
+int RBpersist_insert(rb_persist tree, int key);
+/* Deletes an element with a particular key. */
+int RBpersist_delete(rb_persist tree, int key);
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBpersist_search(rb_persist tree, int key);
+/* Returns the number of elements in the tree. */
+size_t RBpersist_size(rb_persist tree);
+
+/* Returns a read-only view of the tree as it is now, in O(1). Later writes to
+ * the tree do not show in it. Returns NULL if out of memory. */
+rb_version RBsnapshot(rb_persist tree);
+/* Gives up a snapshot, freeing the nodes no other version holds. */
+void RBversion_release(rb_version v);
+/* Returns nonzero if an element with the given key is in the snapshot. */
+int RBversion_search(rb_version v, int key);
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. Returns
+ * the number of keys visited. */
+size_t RBversion_range(rb_version v, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg);
+/* Returns the number of elements in the snapshot. */
+size_t RBversion_size(rb_version v);
+
+#endif /* RBPERSIST_H */
@@ -0,0 +1,456 @@
+#include "RBshard.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+/* Keep each shard on its own cache lines so that threads working on
+ * neighbouring shards don't fight over them. */
+#define RB_SHARD_ALIGN 64
+/* A shard this many times larger than the average triggers a rebalance... */
+#define RB_SHARD_SKEW 4
+/* ...as long as it holds at least this many keys. Shards are only compared
+ * each time one grows by this many, since that reads every shard's count. */
+#define RB_SHARD_MIN 4096
+
+struct rb_shard {
+	_Alignas(RB_SHARD_ALIGN) pthread_mutex_t lock; /* held by writers */
+	rb_tree tree;
+	atomic_size_t count; /* only changed with the lock held */
+};
+/* The split points and the shards between them. A rebalance builds a whole
+ * new layout and swaps it in; the old one is freed once no thread can still
+ * be looking at it. */
+struct rb_shard_layout {
+	/* Shard i holds the keys in [splits[i-1], splits[i]) */
+	int *splits;
+	struct rb_shard *shards;
+};
+struct rb_shards {
+	struct rb_shard_layout *_Atomic layout;
+	size_t nshards;
+	pthread_mutex_t rebalance_lock; /* one rebalance at a time */
+	/* Set while some thread is waiting to rebalance */
+	atomic_int rebalancing;
+};
+
+/* Marks a thread as using some container's layout: gen is odd while it is.
+ * Only the thread itself writes gen, and it has the cache line to itself, so
+ * operations write nothing another core is reading. A rebalance waits for
+ * every odd gen to move on before it frees the layout it replaced. Slots are
+ * never freed; a thread's slot is reused by a later thread once it exits. */
+struct rb_shard_reader {
+	_Alignas(RB_SHARD_ALIGN) atomic_uint gen;
+	atomic_int used;
+	struct rb_shard_reader *next; /* set once, before the slot is listed */
+};
+/* This thread's slot */
+static _Thread_local struct rb_shard_reader *rb_reader = NULL;
+/* Every slot. Only ever pushed onto, so it can be walked without a lock. */
+static struct rb_shard_reader *_Atomic rb_readers = NULL;
+/* Gives a thread's slot back when it exits */
+static pthread_key_t rb_reader_key;
+static pthread_once_t rb_reader_once = PTHREAD_ONCE_INIT;
+
+/* Starts an operation on s and returns its layout, which stays valid until
+ * rb_shards_leave(). Returns NULL if out of memory. */
+static struct rb_shard_layout *rb_shards_enter(rb_shards s);
+/* Ends an operation started by rb_shards_enter(). */
+static void rb_shards_leave();
+/* Locks the shard holding key, moving *l on to the newest layout if a
+ * rebalance replaced it. */
+static struct rb_shard *rb_shards_lock(rb_shards s, struct rb_shard_layout **l,
+		int key);
+/* Waits until no other thread can be using a layout that was replaced before
+ * this was called. */
+static void rb_shards_wait_readers();
+/* Gives this thread a slot. Returns 0 if out of memory. */
+static int rb_reader_register();
+/* Creates the key whose destructor gives a thread's slot back. */
+static void rb_reader_init();
+/* Gives an exiting thread's slot back. */
+static void rb_reader_exit(void *reader);
+/* Allocates a layout of nshards empty, unlocked shards with no trees. */
+static struct rb_shard_layout *rb_layout_new(size_t nshards);
+/* Frees a layout and every tree in it. */
+static void rb_layout_free(struct rb_shard_layout *l, size_t nshards);
+/* Returns the index of the shard in l that holds key. */
+static size_t rb_shard_of(rb_shards s, struct rb_shard_layout *l, int key);
+/* Returns nonzero if a shard of l holding count keys is too big. */
+static int rb_shard_skewed(rb_shards s, struct rb_shard_layout *l, size_t count);
+/* Does the work of RBshards_rebalance: deals the keys of old, which has n of
+ * them, into the trees of new, given room for the keys. Returns 0 if out of
+ * memory, building nothing. */
+static int rb_shards_rebuild(rb_shards s, struct rb_shard_layout *old,
+		struct rb_shard_layout *new, int *keys, size_t n);
+/* Sorts ints, for qsort(). */
+static int rb_int_cmp(const void *a, const void *b);
+
+
+/* Creates a container of nshards trees. */
+rb_shards RBshards_create(size_t nshards, const int *sample, size_t nsample) {
+	rb_shards ret;
+	struct rb_shard_layout *l;
+	size_t i;
+	if (nshards == 0) nshards = 1;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	if ((l = rb_layout_new(nshards)) == NULL) {
+		free(ret);
+		return NULL;
+	}
+	/* Pick split points */
+	if (nsample > 0) {
+		int *sorted = malloc(nsample * sizeof(*sorted));
+		if (sorted == NULL) {
+			fprintf(stderr, "Error: out of memory.\n");
+			nsample = 0;
+		} else {
+			for (i = 0; i < nsample; i++) sorted[i] = sample[i];
+			qsort(sorted, nsample, sizeof(*sorted), rb_int_cmp);
+			for (i = 1; i < nshards; i++) {
+				l->splits[i-1] = sorted[i * nsample / nshards];
+			}
+			free(sorted);
+		}
+	}
+	if (nsample == 0) {
+		for (i = 1; i < nshards; i++) {
+			l->splits[i-1] = (int)(INT_MIN + (long long)i
+					* ((long long)UINT_MAX + 1) / (long long)nshards);
+		}
+	}
+	for (i = 0; i < nshards; i++) {
+		if ((l->shards[i].tree = RBcreate()) == NULL) {
+			rb_layout_free(l, nshards);
+			free(ret);
+			return NULL;
+		}
+	}
+	atomic_init(&ret->layout, l);
+	ret->nshards = nshards;
+	pthread_mutex_init(&ret->rebalance_lock, NULL);
+	atomic_init(&ret->rebalancing, 0);
+	return ret;
+}
+/* Frees the container and every tree in it. */
+void RBshards_free(rb_shards s) {
+	rb_layout_free(atomic_load(&s->layout), s->nshards);
+	pthread_mutex_destroy(&s->rebalance_lock);
+	free(s);
+}
+/* Allocates a layout of nshards empty, unlocked shards with no trees. */
+static struct rb_shard_layout *rb_layout_new(size_t nshards) {
+	struct rb_shard_layout *ret;
+	size_t i;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	ret->splits = malloc(nshards * sizeof(*ret->splits));
+	ret->shards = aligned_alloc(RB_SHARD_ALIGN, nshards * sizeof(*ret->shards));
+	if (ret->splits == NULL || ret->shards == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		free(ret->splits);
+		free(ret->shards);
+		free(ret);
+		return NULL;
+	}
+	for (i = 0; i < nshards; i++) {
+		pthread_mutex_init(&ret->shards[i].lock, NULL);
+		ret->shards[i].tree = NULL;
+		atomic_init(&ret->shards[i].count, 0);
+	}
+	return ret;
+}
+/* Frees a layout and every tree in it. */
+static void rb_layout_free(struct rb_shard_layout *l, size_t nshards) {
+	size_t i;
+	for (i = 0; i < nshards; i++) {
+		if (l->shards[i].tree != NULL) RBfree(l->shards[i].tree);
+		pthread_mutex_destroy(&l->shards[i].lock);
+	}
+	free(l->shards);
+	free(l->splits);
+	free(l);
+}
+
+
+/* Inserts an element with specified key. */
+int RBshards_insert(rb_shards s, int key) {
+	struct rb_shard_layout *l;
+	struct rb_shard *sh;
+	size_t count;
+	int ret, skewed = 0;
+	if ((l = rb_shards_enter(s)) == NULL) {
+		return 0;
+	}
+	sh = rb_shards_lock(s, &l, key);
+	if ((ret = RBinsert(sh->tree, key)) != 0) {
+		count = atomic_load_explicit(&sh->count, memory_order_relaxed) + 1;
+		atomic_store_explicit(&sh->count, count, memory_order_relaxed);
+		skewed = (count % RB_SHARD_MIN == 0) && rb_shard_skewed(s, l, count);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	rb_shards_leave();
+	/* Only one thread needs to do the rebalancing */
+	if (skewed && atomic_exchange(&s->rebalancing, 1) == 0) {
+		RBshards_rebalance(s);
+		atomic_store(&s->rebalancing, 0);
+	}
+	return ret;
+}
+/* Deletes an element with a particular key. */
+int RBshards_delete(rb_shards s, int key) {
+	struct rb_shard_layout *l;
+	struct rb_shard *sh;
+	int ret;
+	if ((l = rb_shards_enter(s)) == NULL) {
+		return 0;
+	}
+	sh = rb_shards_lock(s, &l, key);
+	if ((ret = RBdelete(sh->tree, key)) != 0) {
+		atomic_store_explicit(&sh->count, atomic_load_explicit(&sh->count,
+			memory_order_relaxed) - 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	rb_shards_leave();
+	return ret;
+}
+/* Returns nonzero if an element with the given key is present. */
+/* Lookups don't take the shard's lock: each shard only ever has one writer at
+ * a time, which is exactly what RBsearch_concurrent() allows. A tree a
+ * rebalance replaced is no longer written, and is freed only after we leave. */
+int RBshards_search(rb_shards s, int key) {
+	struct rb_shard_layout *l;
+	int ret;
+	if ((l = rb_shards_enter(s)) == NULL) {
+		return 0;
+	}
+	ret = RBsearch_concurrent(l->shards[rb_shard_of(s, l, key)].tree, key);
+	rb_shards_leave();
+	return ret;
+}
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. */
+/* Shard i only holds keys below those of shard i+1, so visiting the shards in
+ * order visits the keys in order. If a rebalance swaps the layout partway,
+ * the rest of the old shards hold the keys as they were when it did. */
+size_t RBshards_range(rb_shards s, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg) {
+	struct rb_shard_layout *l;
+	size_t count = 0, i, last;
+	if (lo > hi || (l = rb_shards_enter(s)) == NULL) {
+		return 0;
+	}
+	last = rb_shard_of(s, l, hi);
+	for (i = rb_shard_of(s, l, lo); i <= last; i++) {
+		pthread_mutex_lock(&l->shards[i].lock);
+		count += RBrange(l->shards[i].tree, lo, hi, fn, arg);
+		pthread_mutex_unlock(&l->shards[i].lock);
+	}
+	rb_shards_leave();
+	return count;
+}
+/* Returns the number of elements. */
+/* There is no shared total for every insert to bump; the shards' own counts
+ * are added up instead. */
+size_t RBshards_size(rb_shards s) {
+	struct rb_shard_layout *l;
+	size_t count = 0, i;
+	if ((l = rb_shards_enter(s)) == NULL) {
+		return 0;
+	}
+	for (i = 0; i < s->nshards; i++) {
+		count += atomic_load_explicit(&l->shards[i].count, memory_order_relaxed);
+	}
+	rb_shards_leave();
+	return count;
+}
+
+
+/* Moves the split points so that every shard holds the same number of keys. */
+/* Holding every shard's lock keeps writers out while the keys are copied.
+ * The new layout is only swapped in once every new tree has been built, so
+ * running out of memory leaves the container as it was. Writers waiting on
+ * an old shard's lock see the swap and move to the new layout; the old one
+ * is freed once every operation that might have it has finished. */
+void RBshards_rebalance(rb_shards s) {
+	struct rb_shard_layout *old, *new;
+	size_t n = 0, i;
+	int *keys;
+	pthread_mutex_lock(&s->rebalance_lock);
+	old = atomic_load(&s->layout);
+	for (i = 0; i < s->nshards; i++) {
+		pthread_mutex_lock(&old->shards[i].lock);
+		n += atomic_load_explicit(&old->shards[i].count, memory_order_relaxed);
+	}
+	keys = malloc((n ? n : 1) * sizeof(*keys));
+	new = rb_layout_new(s->nshards);
+	if (keys == NULL || new == NULL) {
+		if (keys == NULL) fprintf(stderr, "Error: out of memory.\n");
+		if (new != NULL) rb_layout_free(new, s->nshards);
+		new = NULL;
+	} else if (!rb_shards_rebuild(s, old, new, keys, n)) {
+		rb_layout_free(new, s->nshards);
+		new = NULL;
+	} else {
+		atomic_store(&s->layout, new);
+	}
+	for (i = 0; i < s->nshards; i++) {
+		pthread_mutex_unlock(&old->shards[i].lock);
+	}
+	free(keys);
+	if (new != NULL) {
+		rb_shards_wait_readers();
+		rb_layout_free(old, s->nshards);
+	}
+	pthread_mutex_unlock(&s->rebalance_lock);
+}
+/* Does the work of RBshards_rebalance. */
+/* All the keys come out in order, get dealt into equal runs, and each run is
+ * bulk-loaded into a fresh tree with RBbuild_sorted(). */
+static int rb_shards_rebuild(rb_shards s, struct rb_shard_layout *old,
+		struct rb_shard_layout *new, int *keys, size_t n) {
+	size_t i, pos, shard;
+	pos = 0;
+	for (i = 0; i < s->nshards; i++) {
+		pos += RBrange_keys(old->shards[i].tree, INT_MIN, INT_MAX,
+				keys + pos, n - pos);
+	}
+	if (n > 0) {
+		for (i = 1; i < s->nshards; i++) {
+			new->splits[i-1] = keys[i * n / s->nshards];
+		}
+	} else {
+		memcpy(new->splits, old->splits, s->nshards * sizeof(*new->splits));
+	}
+	/* Deal the keys out by the new split points. Split points can repeat
+	 * when there are few keys, so we route each key rather than assume
+	 * equal runs. */
+	pos = 0;
+	for (shard = 0; shard < s->nshards; shard++) {
+		size_t start = pos;
+		while (pos < n && rb_shard_of(s, new, keys[pos]) == shard) pos++;
+		if ((new->shards[shard].tree = RBbuild_sorted(keys + start,
+				pos - start)) == NULL) {
+			return 0;
+		}
+		atomic_init(&new->shards[shard].count, pos - start);
+	}
+	return 1;
+}
+
+
+/* Starts an operation on s and returns its layout. */
+/* The store to gen has to be seen before we load the layout, and the
+ * rebalancer's store of the layout before it loads gen, so both are
+ * sequentially consistent: either we see the new layout, or it sees us. */
+static struct rb_shard_layout *rb_shards_enter(rb_shards s) {
+	if (rb_reader == NULL && !rb_reader_register()) {
+		return NULL;
+	}
+	atomic_store(&rb_reader->gen,
+		atomic_load_explicit(&rb_reader->gen, memory_order_relaxed) + 1);
+	return atomic_load(&s->layout);
+}
+/* Ends an operation started by rb_shards_enter(). */
+static void rb_shards_leave() {
+	atomic_store_explicit(&rb_reader->gen, atomic_load_explicit(&rb_reader->gen,
+		memory_order_relaxed) + 1, memory_order_release);
+}
+/* Locks the shard holding key, moving on to the newest layout if needed. */
+/* A rebalance swaps the layout while it holds every old shard's lock, so
+ * once we hold a lock and the layout is still ours, it stays ours. */
+static struct rb_shard *rb_shards_lock(rb_shards s, struct rb_shard_layout **l,
+		int key) {
+	struct rb_shard *sh;
+	for (;;) {
+		sh = &(*l)->shards[rb_shard_of(s, *l, key)];
+		pthread_mutex_lock(&sh->lock);
+		if (atomic_load(&s->layout) == *l) {
+			return sh;
+		}
+		pthread_mutex_unlock(&sh->lock);
+		*l = atomic_load(&s->layout);
+	}
+}
+/* Waits until no other thread can be using a replaced layout. */
+/* A thread that was inside an operation when we looked has moved on once its
+ * gen changes. Operations never wait on a rebalance, and range callbacks stay
+ * out of every container, so this can't wait on itself. */
+static void rb_shards_wait_readers() {
+	struct rb_shard_reader *r;
+	unsigned gen;
+	for (r = atomic_load(&rb_readers); r != NULL; r = r->next) {
+		if ((gen = atomic_load(&r->gen)) & 1) {
+			while (atomic_load(&r->gen) == gen) sched_yield();
+		}
+	}
+}
+/* Gives this thread a slot. */
+static int rb_reader_register() {
+	struct rb_shard_reader *r;
+	pthread_once(&rb_reader_once, rb_reader_init);
+	for (r = atomic_load(&rb_readers); r != NULL; r = r->next) {
+		int idle = 0;
+		if (atomic_compare_exchange_strong(&r->used, &idle, 1)) break;
+	}
+	if (r == NULL) {
+		if ((r = aligned_alloc(RB_SHARD_ALIGN, sizeof(*r))) == NULL) {
+			fprintf(stderr, "Error: out of memory.\n");
+			return 0;
+		}
+		atomic_init(&r->gen, 0);
+		atomic_init(&r->used, 1);
+		r->next = atomic_load(&rb_readers);
+		while (!atomic_compare_exchange_weak(&rb_readers, &r->next, r));
+	}
+	rb_reader = r;
+	pthread_setspecific(rb_reader_key, r);
+	return 1;
+}
+/* Creates the key whose destructor gives a thread's slot back. */
+static void rb_reader_init() {
+	pthread_key_create(&rb_reader_key, rb_reader_exit);
+}
+/* Gives an exiting thread's slot back. Its gen is even, as it's in no
+ * operation. */
+static void rb_reader_exit(void *reader) {
+	struct rb_shard_reader *r = reader;
+	atomic_store(&r->used, 0);
+}
+
+
+/* Returns the index of the shard in l that holds key. */
+static size_t rb_shard_of(rb_shards s, struct rb_shard_layout *l, int key) {
+	/* Binary search for the number of split points <= key */
+	size_t lo = 0, hi = s->nshards - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (l->splits[mid] <= key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+/* Returns nonzero if a shard of l holding count keys is too big. */
+static int rb_shard_skewed(rb_shards s, struct rb_shard_layout *l, size_t count) {
+	size_t total = 0, i;
+	if (count < RB_SHARD_MIN) return 0;
+	for (i = 0; i < s->nshards; i++) {
+		total += atomic_load_explicit(&l->shards[i].count, memory_order_relaxed);
+	}
+	return count > RB_SHARD_SKEW * (total / s->nshards);
+}
+/* Sorts ints, for qsort(). */
+static int rb_int_cmp(const void *a, const void *b) {
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
@@ -0,0 +1,39 @@
+#ifndef RBSHARD_H
+#define RBSHARD_H
+
+#include "RBtree.h"
+
+/* A set of ints split by key range over several Red-Black trees, each with
+ * its own lock, so that threads writing to different ranges don't wait for
+ * each other. Every function here may be called from any number of threads at
+ * once. */
+typedef struct rb_shards *rb_shards;
+
+/* Creates a container of nshards trees. The split points between shards are
+ * chosen so that the nsample keys in sample (in any order) would be spread
+ * evenly; with no sample the whole int range is split evenly. */
+rb_shards RBshards_create(size_t nshards, const int *sample, size_t nsample);
+/* Frees the container and every tree in it. */
+void RBshards_free(rb_shards s);
+
+/* Inserts an element with specified key. */
+int RBshards_insert(rb_shards s, int key);
+/* Deletes an element with a particular key. */
+int RBshards_delete(rb_shards s, int key);
+/* Returns nonzero if an element with the given key is present. */
+int RBshards_search(rb_shards s, int key);
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order, even
+ * across shards. fn runs with a shard locked, so it must not call into this
+ * or any other rb_shards container. Returns the number of keys visited. */
+size_t RBshards_range(rb_shards s, int lo, int hi,
+		void (*fn)(int key, void *arg), void *arg);
+/* Returns the number of elements. */
+size_t RBshards_size(rb_shards s);
+
+/* Moves the split points so that every shard holds the same number of keys.
+ * This happens by itself when one shard grows much larger than the average;
+ * it takes O(n) and blocks inserts and deletes while it runs. Lookups go on
+ * reading the old shards until the new ones are in place. */
+void RBshards_rebalance(rb_shards s);
+
+#endif /* RBSHARD_H */
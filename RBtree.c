@@ -3,6 +3,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
 
 
 /******************************************************************************
@@ -15,47 +25,192 @@ rb_tree RBcreate() {
 		fprintf(stderr, "Error: out of memory.\n");
 		return NULL;
 	}
-	/* We can't use rb_new_node() because it wants to set some of the values
-	 * to tree->nil. */
-	if ((ret->nil = malloc(sizeof(*ret->nil))) == NULL) {
-		fprintf(stderr, "Error: out of memory.\n");
-		/* Allocation of ret had been successful; we need to free it. */
-		free(ret);
+	rb_init_tree(ret);
+	return ret;
+}
+/* Builds a tree from n keys in strictly increasing order in O(n). */
+/* The tree is built by always choosing the median as the root, so every path
+ * from the root ends at depth floor(log2(n+1)) or one below it. Coloring just
+ * that partial bottom level red gives every path the same number of black
+ * nodes. */
+rb_tree RBbuild_sorted(const int *keys, size_t n) {
+	rb_tree ret;
+	struct rb_slab *block; /* every node of the tree */
+	size_t i;
+	int red_depth = 0; /* depth of the (possibly partial) bottom level */
+	for (i = 1; i < n; i++) {
+		if (keys[i-1] >= keys[i]) {
+			fprintf(stderr, "Error: keys not strictly increasing at "
+					"position %lu.\n", (unsigned long)i);
+			return NULL;
+		}
+	}
+	if ((ret = RBcreate()) == NULL) {
+		return NULL;
+	}
+	if (n == 0) {
+		return ret;
+	}
+	if ((block = rb_new_slab(ret, n)) == NULL) {
+		RBfree(ret);
+		return NULL;
+	}
+	while (((size_t)2 << red_depth) - 1 <= n) {
+		red_depth++;
+	}
+	ret->root = rb_build_subtree(ret, block->nodes, keys, 0, n, 0, red_depth);
+	ret->root->parent = ret->nil;
+	return ret;
+}
+/* Helper routine: links keys[lo..hi) into a balanced subtree. Node i of the
+ * block holds keys[i], so the nodes are laid out in key order. */
+static rb_node rb_build_subtree(rb_tree tree, rb_node nodes, const int *keys,
+		size_t lo, size_t hi, int depth, int red_depth) {
+	size_t mid = lo + (hi - lo) / 2;
+	rb_node n;
+	if (lo == hi) return tree->nil;
+	n = &nodes[mid];
+	n->key = keys[mid];
+	n->color = (depth == red_depth) ? 'r' : 'b';
+	n->lchild = rb_build_subtree(tree, nodes, keys, lo, mid, depth + 1, red_depth);
+	n->rchild = rb_build_subtree(tree, nodes, keys, mid + 1, hi, depth + 1, red_depth);
+	if (n->lchild != tree->nil) n->lchild->parent = n;
+	if (n->rchild != tree->nil) n->rchild->parent = n;
+	return n;
+}
+/* Makes a copy of a tree in O(n). */
+/* One in-order walk takes the copies from the new tree's arena as it goes, so
+ * they fill its slabs in key order with no pass to count them first. The walk
+ * keeps its depth, and last[d] is the newest copy at depth d. When a node is reached, its left subtree is done and
+ * the root of that is the newest copy one level down; when a right child is
+ * reached, the newest copy one level up is its parent. */
+rb_tree RBclone(rb_tree tree) {
+	rb_tree ret;
+	rb_node last[RB_MAX_HEIGHT];
+	rb_node n = tree->root, c;
+	int depth = 0;
+	if ((ret = RBcreate()) == NULL) {
 		return NULL;
 	}
-	ret->nil->color = 'b';
-	ret->nil->lchild = ret->nil;
-	ret->nil->rchild = ret->nil;
-	ret->nil->parent = ret->nil;
-	ret->root = ret->nil;
+	if (tree->root == tree->nil) {
+		return ret;
+	}
+	/* As in rb_preorder_next, each right child we pass on the way down is
+	 * fetched while the left subtree is copied */
+	for (; n->lchild != tree->nil; n = n->lchild) {
+		rb_prefetch(n->rchild);
+		depth++;
+	}
+	for (;;) {
+		if ((c = rb_new_node(ret, n->key)) == NULL) {
+			RBfree(ret);
+			return NULL;
+		}
+		c->color = n->color;
+		if (n->lchild != tree->nil) {
+			c->lchild = last[depth+1];
+			c->lchild->parent = c;
+		} else {
+			c->lchild = ret->nil;
+		}
+		if (depth == 0) {
+			c->parent = ret->nil;
+			ret->root = c;
+		} else if (n == n->parent->rchild) {
+			c->parent = last[depth-1];
+			c->parent->rchild = c;
+		}
+		last[depth] = c;
+		/* On to the successor */
+		if (n->rchild != tree->nil) {
+			n = n->rchild;
+			depth++;
+			for (; n->lchild != tree->nil; n = n->lchild) {
+				rb_prefetch(n->rchild);
+				depth++;
+			}
+		} else {
+			while (n->parent != tree->nil && n == n->parent->rchild) {
+				n = n->parent;
+				depth--;
+			}
+			if (n->parent == tree->nil) {
+				break;
+			}
+			n = n->parent;
+			depth--;
+		}
+	}
 	return ret;
 }
+/* Returns the number of nodes in a tree. */
+/* The slabs can't tell us: they also hold free nodes and, after a split or
+ * join, nodes of other trees, so we walk the tree. */
+static size_t rb_count_nodes(rb_tree tree) {
+	rb_node n;
+	size_t count = 0;
+	if (tree->root == tree->nil) {
+		return 0;
+	}
+	for (n = rb_min(tree, tree->root); n != tree->nil; n = rb_successor(tree, n)) {
+		count++;
+	}
+	return count;
+}
 /* Frees an entire tree. */
+/* Every node lives in one of the tree's slabs, so we never need to visit the
+ * nodes themselves: this is O(number of slabs). */
 void RBfree(rb_tree tree) {
-	rb_free_subtree(tree, tree->root);
-	rb_free_node(tree->nil);
+	rb_free_slabs(tree->slabs);
+	rb_arena_release(tree->shared);
 	free(tree);
 }
-/* Helper routine: frees a subtree rooted at specified node. */
-static void rb_free_subtree(rb_tree tree, rb_node node) {
-	if (node == tree->nil) return; /* We only free tree->nil once */
-	rb_free_subtree(tree, node->lchild);
-	rb_free_subtree(tree, node->rchild);
-	rb_free_node(node);
+/* Sets up an empty tree with no slabs. */
+static void rb_init_tree(rb_tree tree) {
+	tree->nil = &rb_nil;
+	tree->root = tree->nil;
+	atomic_init(&tree->seq, 0);
+	tree->slabs = NULL;
+	tree->bump = tree->bump_end = NULL;
+	tree->free_nodes = NULL;
+	tree->next_slab_len = RB_SLAB_MIN;
+	tree->shared = NULL;
+	rb_init_stats(tree);
+}
+/* Zeroes a new tree's counters. */
+static void rb_init_stats(rb_tree tree) {
+	int i;
+	memset(&tree->stats, 0, sizeof(tree->stats));
+	for (i = 0; i < RB_STAT_SLOTS; i++) {
+		atomic_init(&tree->stats.search[i].searches, 0);
+		atomic_init(&tree->stats.search[i].steps, 0);
+	}
 }
 /* Creates a new node. */
 static rb_node rb_new_node(rb_tree tree, int data) {
 	rb_node ret;
-	/* We take nodes from the memory pool if we can; else just allocate it. */
-	if (rb_mem_pool != NULL) {
-		ret = rb_mem_pool;
-		rb_mem_pool = ret->parent;
+	/* Reuse a node given back to this tree if we can, else carve one off
+	 * the newest slab, else get a new slab. */
+	if (tree->free_nodes != NULL) {
+		ret = tree->free_nodes;
+		tree->free_nodes = ret->parent;
+		RB_STAT(tree, pool_hits);
 	} else {
-		if ((ret = malloc(sizeof(*ret))) == NULL) {
-			fprintf(stderr, "Error: out of memory.\n");
-			return NULL;
+		if (tree->bump == tree->bump_end) {
+			struct rb_slab *slab = rb_new_slab(tree, tree->next_slab_len);
+			if (slab == NULL) {
+				return NULL;
+			}
+			tree->bump = slab->nodes;
+			tree->bump_end = slab->nodes + slab->len;
+			if (tree->next_slab_len < RB_SLAB_MAX) {
+				tree->next_slab_len *= 2;
+			}
 		}
+		ret = tree->bump++;
+		RB_STAT(tree, pool_fresh);
 	}
+	RB_TRACE_EVENT(3, tree, RB_TRACE_ALLOC, 0, data);
 	ret->key = data;
 	ret->parent = tree->nil;
 	ret->lchild = tree->nil;
@@ -63,17 +218,198 @@ static rb_node rb_new_node(rb_tree tree, int data) {
 	ret->color = 'r';
 	return ret;
 }
-/* Frees a node to the memory pool. */
-static void rb_free_node(rb_node node) {
-	node->parent = rb_mem_pool;
-	rb_mem_pool = node;
+/* Gives a node back to the tree's arena. */
+static void rb_free_node(rb_tree tree, rb_node node) {
+	RB_TRACE_EVENT(3, tree, RB_TRACE_FREE, 0, node->key);
+	node->parent = tree->free_nodes;
+	tree->free_nodes = node;
+}
+/* Adds a slab of len nodes to the tree's arena. */
+static struct rb_slab *rb_new_slab(rb_tree tree, size_t len) {
+	struct rb_slab *ret;
+	if (len == RB_SLAB_MAX && (ret = rb_get_slab()) != NULL) {
+		/* Reusing a spare slab */
+		RB_STAT(tree, slab_reuses);
+	} else if ((ret = malloc(sizeof(*ret) + len * sizeof(ret->nodes[0]))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	} else {
+		RB_STAT(tree, slab_mallocs);
+	}
+	ret->len = len;
+	ret->next = tree->slabs;
+	tree->slabs = ret;
+	return ret;
+}
+/* Frees a list of slabs. */
+static void rb_free_slabs(struct rb_slab *slabs) {
+	while (slabs != NULL) {
+		struct rb_slab *cur = slabs;
+		slabs = cur->next;
+		/* Keep full-sized slabs around for the next tree */
+		if (cur->len == RB_SLAB_MAX) {
+			rb_put_slab(cur);
+		} else {
+			free(cur);
+		}
+	}
+}
+/* Allocates an empty arena. */
+static struct rb_arena *rb_arena_new() {
+	struct rb_arena *ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	atomic_init(&ret->refs, 1);
+	ret->slabs = NULL;
+	ret->parents[0] = ret->parents[1] = NULL;
+	return ret;
+}
+/* Drops a reference to an arena. */
+/* Trees that were split and joined many times can leave long chains of
+ * arenas, so instead of recursing we keep a list of the ones to free. Only an
+ * arena whose last reference we dropped goes on the list, so no other thread
+ * can be looking at its next field. */
+static void rb_arena_release(struct rb_arena *arena) {
+	struct rb_arena *todo;
+	if (arena == NULL || atomic_fetch_sub(&arena->refs, 1) != 1) {
+		return;
+	}
+	arena->next = NULL;
+	todo = arena;
+	while (todo != NULL) {
+		struct rb_arena *cur = todo;
+		int i;
+		todo = cur->next;
+		rb_free_slabs(cur->slabs);
+		for (i = 0; i < 2; i++) {
+			struct rb_arena *p = cur->parents[i];
+			if (p != NULL && atomic_fetch_sub(&p->refs, 1) == 1) {
+				p->next = todo;
+				todo = p;
+			}
+		}
+		free(cur);
+	}
+}
+/* Takes a spare full-sized slab from this thread's cache or the depot. */
+static struct rb_slab *rb_get_slab() {
+	struct rb_slab *ret, *rest;
+	if (rb_cache.slabs == NULL) {
+		/* Empty the whole depot, keep up to half a cache's worth of
+		 * slabs and put back the rest. */
+		rest = atomic_exchange(&rb_slab_depot, NULL);
+		if (rest != NULL) {
+			rb_cache_register();
+		}
+		while (rest != NULL && rb_cache.count < RB_CACHE_SLABS / 2) {
+			struct rb_slab *cur = rest;
+			rest = cur->next;
+			cur->next = rb_cache.slabs;
+			rb_cache.slabs = cur;
+			rb_cache.count++;
+		}
+		if (rest != NULL) {
+			struct rb_slab *last = rest;
+			while (last->next != NULL) last = last->next;
+			rb_depot_push(rest, last);
+		}
+		if (rb_cache.slabs == NULL) {
+			return NULL;
+		}
+	}
+	ret = rb_cache.slabs;
+	rb_cache.slabs = ret->next;
+	rb_cache.count--;
+	return ret;
+}
+/* Keeps a full-sized slab for later. */
+static void rb_put_slab(struct rb_slab *slab) {
+	rb_cache_register();
+	/* If the cache is full, spill half of it into the depot */
+	if (rb_cache.count == RB_CACHE_SLABS) {
+		struct rb_slab *first = rb_cache.slabs, *last = first;
+		while (rb_cache.count > RB_CACHE_SLABS / 2 + 1) {
+			last = last->next;
+			rb_cache.count--;
+		}
+		rb_cache.slabs = last->next;
+		rb_cache.count--;
+		rb_depot_push(first, last);
+	}
+	slab->next = rb_cache.slabs;
+	rb_cache.slabs = slab;
+	rb_cache.count++;
+}
+/* Lists this thread's cache for RBcleanup() and flushes it at thread exit. */
+/* Called before a slab first goes into the cache, whether a freed tree put it
+ * there or rb_get_slab() moved it over from the depot. */
+static void rb_cache_register() {
+	if (rb_cache.registered) {
+		return;
+	}
+	pthread_once(&rb_cache_once, rb_cache_init);
+	pthread_mutex_lock(&rb_caches_lock);
+	rb_cache.next = rb_caches;
+	rb_caches = &rb_cache;
+	rb_cache.registered = 1;
+	pthread_mutex_unlock(&rb_caches_lock);
+	pthread_setspecific(rb_cache_key, &rb_cache);
+}
+/* Pushes the chain of slabs first..last onto the depot. */
+static void rb_depot_push(struct rb_slab *first, struct rb_slab *last) {
+	struct rb_slab *head = atomic_load(&rb_slab_depot);
+	do {
+		last->next = head;
+	} while (!atomic_compare_exchange_weak(&rb_slab_depot, &head, first));
+}
+/* Creates the key whose destructor flushes a thread's cache. */
+static void rb_cache_init() {
+	pthread_key_create(&rb_cache_key, rb_cache_exit);
+}
+/* Flushes an exiting thread's cache into the depot. */
+static void rb_cache_exit(void *cache) {
+	struct rb_slab_cache *c = cache, **pos;
+	if (c->slabs != NULL) {
+		struct rb_slab *last = c->slabs;
+		while (last->next != NULL) last = last->next;
+		rb_depot_push(c->slabs, last);
+		c->slabs = NULL;
+		c->count = 0;
+	}
+	/* This thread's storage is about to go away */
+	pthread_mutex_lock(&rb_caches_lock);
+	for (pos = &rb_caches; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == c) {
+			*pos = c->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rb_caches_lock);
+	c->registered = 0;
 }
-/* Frees entire memory pool to main memory. */
+/* Frees every spare slab to main memory. */
+/* Other threads' caches are drained too, so no other thread may be using the
+ * library while this runs. */
 void RBcleanup() {
-	while (rb_mem_pool != NULL) {
-		rb_node cur = rb_mem_pool;
-		rb_mem_pool = cur->parent;
+	struct rb_slab_cache *c;
+	struct rb_slab *cur;
+	rb_pool_stop_all();
+	pthread_mutex_lock(&rb_caches_lock);
+	for (c = rb_caches; c != NULL; c = c->next) {
+		while ((cur = c->slabs) != NULL) {
+			c->slabs = cur->next;
+			free(cur);
+		}
+		c->count = 0;
+	}
+	pthread_mutex_unlock(&rb_caches_lock);
+	cur = atomic_exchange(&rb_slab_depot, NULL);
+	while (cur != NULL) {
+		struct rb_slab *next = cur->next;
 		free(cur);
+		cur = next;
 	}
 }
 
@@ -109,18 +445,29 @@ int RBinsert(rb_tree tree, int key) {
 	if (newnode == NULL) {
 		return 0;
 	}
+	rb_link_node(tree, newnode, newparent);
+	return 1;
+}
+/* Links a new node in below parent (on the side its key calls for) and
+ * restores the Red-Black properties. */
+static void rb_link_node(rb_tree tree, rb_node newnode, rb_node newparent) {
+	rb_write_begin(tree);
+	RB_STAT(tree, inserts);
+	RB_TRACE_EVENT(1, tree, RB_TRACE_INSERT, 0, newnode->key);
 	/* Set up the parent node */
 	newnode->parent = newparent;
+	/* Readers must not find newnode before they can see its fields */
+	atomic_thread_fence(memory_order_release);
 	if (newparent == tree->nil) {
 		tree->root = newnode;
-	} else if (key < newparent->key) {
+	} else if (newnode->key < newparent->key) {
 		newparent->lchild = newnode;
 	} else {
 		newparent->rchild = newnode;
 	}
 	/* Fix the tree structure */
 	rb_insert_fix(tree, newnode);
-	return 1;
+	rb_write_end(tree);
 }
 /* Corrects for properties violated on an insertion. */
 static void rb_insert_fix(rb_tree tree, rb_node n) {
@@ -128,6 +475,8 @@ static void rb_insert_fix(rb_tree tree, rb_node n) {
 		uncle = rb_get_uncle(tree, n);
 	/* Case 1: uncle is colored red */
 	while (n->parent->color == 'r' && uncle->color == 'r') {
+		RB_STAT(tree, insert_case[0]);
+		RB_TRACE_EVENT(2, tree, RB_TRACE_INSERT_CASE, 1, n->key);
 		gp->color = 'r';
 		uncle->color = 'b';
 		n->parent->color = 'b';
@@ -144,10 +493,14 @@ static void rb_insert_fix(rb_tree tree, rb_node n) {
 	/* Case 2: node is "close to" uncle */
 	if ((n->parent->lchild == n) == (gp->lchild == uncle)) {
 		rb_node new_n = n->parent;
+		RB_STAT(tree, insert_case[1]);
+		RB_TRACE_EVENT(2, tree, RB_TRACE_INSERT_CASE, 2, n->key);
 		rb_rotate(tree, new_n, new_n->rchild == n);
 		n = new_n;
 	} /* Fall through */
 	/* Case 3: node is "far from" uncle */
+	RB_STAT(tree, insert_case[2]);
+	RB_TRACE_EVENT(2, tree, RB_TRACE_INSERT_CASE, 3, n->key);
 	n->parent->color = 'b';
 	gp->color = 'r';
 	rb_rotate(tree, gp, gp->lchild == uncle);
@@ -173,21 +526,37 @@ static rb_node rb_get_uncle(rb_tree tree, rb_node n) {
 int RBdelete(rb_tree tree, int key) {
 	/* The node with the actual key */
 	rb_node dead = rb_get_node_by_key(tree, key);
-	/* The node where we will fix the tree structure */
-	rb_node fixit;
-	/* Original color of the deleted node */
-	char orig_col = dead->color;
 	/* Node does not exist, so we cannot delete it */
 	if (dead == tree->nil) {
 		fprintf(stderr, "Error: node %i does not exist.\n", key);
 		return 0;
 	}
+	rb_unlink_node(tree, dead);
+	rb_free_node(tree, dead);
+	return 1;
+}
+/* Takes a node out of the tree and restores the Red-Black properties. The
+ * node itself is left for the caller to free. */
+static void rb_unlink_node(rb_tree tree, rb_node dead) {
+	/* The node where we will fix the tree structure */
+	rb_node fixit;
+	/* fixit's parent. fixit may be tree->nil, whose parent field we never
+	 * write (it is shared and read by lock-free readers), so we keep track
+	 * of it ourselves. */
+	rb_node fixparent;
+	/* Original color of the deleted node */
+	char orig_col = dead->color;
+	rb_write_begin(tree);
+	RB_STAT(tree, deletes);
+	RB_TRACE_EVENT(1, tree, RB_TRACE_DELETE, 0, dead->key);
 	/* Here we perform binary tree deletion */
 	if (dead->lchild == tree->nil) {
 		fixit = dead->rchild;
+		fixparent = dead->parent;
 		rb_transplant(tree, dead, fixit);
 	} else if (dead->rchild == tree->nil) {
 		fixit = dead->lchild;
+		fixparent = dead->parent;
 		rb_transplant(tree, dead, fixit);
 	} else {
 		/* Replace dead with its successor */
@@ -195,9 +564,10 @@ int RBdelete(rb_tree tree, int key) {
 		orig_col = successor->color;
 		fixit = successor->rchild;
 		if (successor->parent == dead) {
-			fixit->parent = successor;
+			fixparent = successor;
 		} else {
 			/* Put the successor's right child into its place */
+			fixparent = successor->parent;
 			rb_transplant(tree, successor, successor->rchild);
 			successor->rchild = dead->rchild;
 			successor->rchild->parent = successor;
@@ -207,12 +577,11 @@ int RBdelete(rb_tree tree, int key) {
 		successor->lchild->parent = successor;
 		successor->color = dead->color;
 	}
-	rb_free_node(dead);
 	/* Only need to fix if we deleted a black node */
 	if (orig_col == 'b') {
-		rb_delete_fix(tree, fixit);
+		rb_delete_fix(tree, fixit, fixparent);
 	}
-	return 1;
+	rb_write_end(tree);
 }
 /* Helper routine: transplants node `from' into node `to's position. */
 static void rb_transplant(rb_tree tree, rb_node to, rb_node from) {
@@ -223,32 +592,42 @@ static void rb_transplant(rb_tree tree, rb_node to, rb_node from) {
 	} else {
 		to->parent->rchild = from;
 	}
-	from->parent = to->parent;
+	if (from != tree->nil) {
+		from->parent = to->parent;
+	}
 }
-/* Corrects for properties violated on a deletion. */
-static void rb_delete_fix(rb_tree tree, rb_node n) {
+/* Corrects for properties violated on a deletion. n may be tree->nil, so its
+ * parent is passed in separately. */
+static void rb_delete_fix(rb_tree tree, rb_node n, rb_node parent) {
 	/* It's always safe to change the root black, and if we reach a red
 	 * node, we can fix the tree by changing it black. */
 	while (n != tree->root && n->color == 'b') {
 		/* Instead of duplicating code, we just have a flag to test
 		 * which direction we are dealing with. */
-		int is_left = (n == n->parent->lchild);
-		rb_node sibling = (is_left) ? n->parent->rchild : n->parent->lchild;
+		int is_left = (n == parent->lchild);
+		rb_node sibling = (is_left) ? parent->rchild : parent->lchild;
 		/* Case 1: sibling red */
 		if (sibling->color == 'r') {
+			RB_STAT(tree, delete_case[0]);
+			RB_TRACE_EVENT(2, tree, RB_TRACE_DELETE_CASE, 1, parent->key);
 			sibling->color = 'b';
-			sibling->parent->color = 'r';
-			rb_rotate(tree, sibling->parent, is_left);
-			sibling = (is_left) ? n->parent->rchild : n->parent->rchild;
+			parent->color = 'r';
+			rb_rotate(tree, parent, is_left);
+			sibling = (is_left) ? parent->rchild : parent->lchild;
 		}
 		/* Case 2: sibling black, both sibling's children black */
 		if (sibling->lchild->color == 'b' && sibling->rchild->color == 'b') {
+			RB_STAT(tree, delete_case[1]);
+			RB_TRACE_EVENT(2, tree, RB_TRACE_DELETE_CASE, 2, parent->key);
 			sibling->color = 'r';
-			n = n->parent;
+			n = parent;
+			parent = n->parent;
 		} else {
 			/* Case 3: sibling black, "far" child black */
 			if (( is_left && sibling->rchild->color == 'b') ||
 			    (!is_left && sibling->lchild->color == 'b')) {
+				RB_STAT(tree, delete_case[2]);
+				RB_TRACE_EVENT(2, tree, RB_TRACE_DELETE_CASE, 3, parent->key);
 				if (is_left) {
 					sibling->lchild->color = 'b';
 				} else {
@@ -256,22 +635,26 @@ static void rb_delete_fix(rb_tree tree, rb_node n) {
 				}
 				sibling->color = 'r';
 				rb_rotate(tree, sibling, !is_left);
-				sibling = (is_left) ? n->parent->rchild : n->parent->lchild;
+				sibling = (is_left) ? parent->rchild : parent->lchild;
 			} /* Fall through */
 			/* Case 4: sibling black, "far" child red */
-			sibling->color = n->parent->color;
-			n->parent->color = 'b';
+			RB_STAT(tree, delete_case[3]);
+			RB_TRACE_EVENT(2, tree, RB_TRACE_DELETE_CASE, 4, parent->key);
+			sibling->color = parent->color;
+			parent->color = 'b';
 			if (is_left) {
 				sibling->rchild->color = 'b';
 			} else {
 				sibling->lchild->color = 'b';
 			}
-			rb_rotate(tree, n->parent, is_left);
+			rb_rotate(tree, parent, is_left);
 			/* We're done, so set n to the root node */
 			n = tree->root;
 		}
 	}
-	n->color = 'b';
+	if (n != tree->nil) {
+		n->color = 'b';
+	}
 }
 
 
@@ -282,152 +665,1131 @@ static void rb_delete_fix(rb_tree tree, rb_node n) {
  *****************************************************************************/
 /* Writes a tree to stdout in preorder format. */
 void RBwrite(rb_tree tree) {
+	RBwrite_to(tree, stdout);
+}
+/* Writes a tree to fp in preorder format. */
+/* Instead of having to keep track of "is this the last node or not?", we
+ * print the first node with no semicolon, then print the semicolon BEFORE the
+ * other nodes. Nodes are formatted by hand into one big buffer, which goes out
+ * in a single fwrite whenever it fills. */
+int RBwrite_to(rb_tree tree, FILE *fp) {
+	struct rb_io io;
+	rb_node n;
+	char *p;
 	if (tree->root == tree->nil) {
 		fprintf(stderr, "Error: empty tree\n");
-		return;
+		return 0;
 	}
-	/* Special case to account for missing semicolon */
-	printf("%c, %d", tree->root->color, tree->root->key);
-	rb_preorder_write(tree, tree->root->lchild);
-	rb_preorder_write(tree, tree->root->rchild);
-	putchar('\n');
-}
-/* Helper routine: write an entire subtree to stdout. */
-static void rb_preorder_write(rb_tree tree, rb_node n) {
-	if (n == tree->nil) return;
-	/* Instead of having to keep track of "is this the last node or not?",
-	 * we just print the first node with no semicolon, then print the
-	 * semicolon BEFORE the other nodes. */
-	printf("; %c, %d", n->color, n->key);
-	rb_preorder_write(tree, n->lchild);
-	rb_preorder_write(tree, n->rchild);
-}
-/* Reads a tree in preorder format from RBREADFILE. */
-/* This function implements an algorithm which is O(n) in the number of nodes,
- * more efficient than the trivial O(n*log(n)) algorithm. */
+	io.fp = fp;
+	io.len = 0;
+	io.failed = 0;
+	if ((io.buf = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	for (n = tree->root; n != tree->nil; n = rb_preorder_next(tree, n)) {
+		if (io.len + RB_TEXT_NODE > RB_IO_BUF) rb_io_flush(&io);
+		p = (char *)io.buf + io.len;
+		if (n != tree->root) {
+			*p++ = ';';
+			*p++ = ' ';
+		}
+		*p++ = n->color;
+		*p++ = ',';
+		*p++ = ' ';
+		p += rb_format_int(p, n->key);
+		io.len = p - (char *)io.buf;
+	}
+	rb_io_put(&io, "\n", 1);
+	rb_io_flush(&io);
+	free(io.buf);
+	return !io.failed && fflush(fp) == 0;
+}
+/* Writes the keys of a tree to fp in increasing order, one per line. */
+int RBwrite_sorted_to(rb_tree tree, FILE *fp) {
+	struct rb_io io;
+	rb_node n;
+	char *p;
+	io.fp = fp;
+	io.len = 0;
+	io.failed = 0;
+	if ((io.buf = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	for (n = rb_min(tree, tree->root); n != tree->nil; n = rb_successor(tree, n)) {
+		if (io.len + RB_TEXT_NODE > RB_IO_BUF) rb_io_flush(&io);
+		p = (char *)io.buf + io.len;
+		p += rb_format_int(p, n->key);
+		*p++ = '\n';
+		io.len = p - (char *)io.buf;
+	}
+	rb_io_flush(&io);
+	free(io.buf);
+	return !io.failed && fflush(fp) == 0;
+}
+/* Returns the node after n in preorder, or nil. */
+/* Go down to the first child if there is one. Otherwise climb until we come
+ * up from a left child whose sibling is still to do, and go there. */
+static rb_node rb_preorder_next(rb_tree tree, rb_node n) {
+	rb_node from;
+	/* The right child is visited after the whole left subtree, so start
+	 * fetching it now */
+	rb_prefetch(n->rchild);
+	if (n->lchild != tree->nil) return n->lchild;
+	if (n->rchild != tree->nil) return n->rchild;
+	do {
+		from = n;
+		n = n->parent;
+	} while (n != tree->nil && (from == n->rchild || n->rchild == tree->nil));
+	return (n != tree->nil) ? n->rchild : tree->nil;
+}
+/* Writes the decimal form of v to p and returns the number of characters. */
+/* Two digits at a time from a table, right to left into a scratch buffer. */
+static int rb_format_int(char *p, int v) {
+	static const char digits[201] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char tmp[12], *q = tmp + sizeof(tmp);
+	unsigned int u = (v < 0) ? 0u - (unsigned int)v : (unsigned int)v;
+	int len;
+	while (u >= 100) {
+		unsigned int d = u % 100 * 2;
+		u /= 100;
+		*--q = digits[d + 1];
+		*--q = digits[d];
+	}
+	if (u >= 10) {
+		*--q = digits[u * 2 + 1];
+		*--q = digits[u * 2];
+	} else {
+		*--q = (char)('0' + u);
+	}
+	if (v < 0) *--q = '-';
+	len = tmp + sizeof(tmp) - q;
+	memcpy(p, q, len);
+	return len;
+}
+/* Reads a tree in preorder format from file fname. */
 rb_tree RBread(char *fname) {
+	struct rb_scan s;
 	rb_tree ret;
-	rb_node root;
-	FILE *infp = fopen(fname, "r");
-	if (infp == NULL) {
+	if ((s.fp = fopen(fname, "r")) == NULL) {
 		fprintf(stderr, "Error: couldn't read file %s.\n", fname);
 		return NULL;
 	}
-	/* Create the tree to return */
-	ret = RBcreate();
-	if (ret != NULL) {
-		root = rb_read_node(ret, infp);
-		/* Read in nodes from negative infinity to INT_MAX. */
-		ret->root = rb_read_subtree(ret, &root, INT_MAX, infp);
+	if ((s.start = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		fclose(s.fp);
+		return NULL;
 	}
-	fclose(infp);
+	s.p = s.end = s.start;
+	s.fname = fname;
+	ret = rb_read_text(&s);
+	free((char *)s.start);
+	fclose(s.fp);
 	return ret;
 }
-/* Reads a tree in preorder format, limited by the maximum value of max. */
-static rb_node rb_read_subtree(rb_tree tree, rb_node *next, int max, FILE *fp) {
-	rb_node ret = *next;
-	/* Either the tree is complete or we don't belong here */
-	if (ret == NULL || ret->key > max) {
-		return tree->nil;
+/* Reads a tree in preorder format from file fname, mapping it into memory. */
+rb_tree RBread_mmap(char *fname) {
+	struct rb_scan s;
+	struct stat st;
+	rb_tree ret;
+	void *map = NULL;
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error: couldn't read file %s.\n", fname);
+		if (fd >= 0) close(fd);
+		return NULL;
 	}
-	*next = rb_read_node(tree, fp);
-	/* Nodes up to my own value belong to my left subtree */
-	ret->lchild = rb_read_subtree(tree, next, ret->key - 1, fp);
-	ret->lchild->parent = ret;
-	/* Nodes up to my maximum belong to my right subtree */
-	ret->rchild = rb_read_subtree(tree, next, max, fp);
-	ret->rchild->parent = ret;
+	/* An empty file can't be mapped, but is an empty tree all the same */
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "Error: couldn't map file %s.\n", fname);
+			close(fd);
+			return NULL;
+		}
+		posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	}
+	close(fd);
+	s.start = s.p = map;
+	s.end = s.start + st.st_size;
+	s.fp = NULL;
+	s.fname = fname;
+	ret = rb_read_text(&s);
+	if (map != NULL) munmap(map, st.st_size);
 	return ret;
 }
-/* Helper routine: read a single node from file fp. */
-static rb_node rb_read_node(rb_tree tree, FILE *fp) {
-	rb_node n; /* the node to return */
-	char col;  /* the color of the node */
-	int data;  /* the data of the node */
-	/* Skip optional semicolon */
-	fscanf(fp, " ; ");
-	/* If node is invalid (or we've reached EOF), die a painful death */
-	if (fscanf(fp, " %c, %d ", &col, &data) != 2 || (col != 'b' && col != 'r')) {
+/* Builds a tree from the text in s, or returns NULL if it's malformed. */
+/* This function implements an algorithm which is O(n) in the number of nodes,
+ * more efficient than the trivial O(n*log(n)) algorithm. */
+static rb_tree rb_read_text(struct rb_scan *s) {
+	rb_tree ret;
+	/* Create the tree to return */
+	if ((ret = RBcreate()) == NULL) {
 		return NULL;
 	}
-	n = rb_new_node(tree, data);
-	if (n != NULL) n->color = col;
-	return n;
+	switch (rb_load_text(&rb_tree_load, ret, s)) {
+	case RB_READ_FAILED:
+		s->failed = 1;
+		break;
+	case RB_READ_REPAIR:
+		if (!rb_rebuild(ret)) s->failed = 1;
+		break;
+	}
+	if (s->failed) {
+		RBfree(ret);
+		return NULL;
+	}
+	return ret;
 }
-
-
-
-
-/******************************************************************************
- * Section 5: General helper routines
- *****************************************************************************/
-/* Returns a node with the given key. */
-static rb_node rb_get_node_by_key(rb_tree haystack, int needle) {
-	rb_node pos = haystack->root; /* our current position */
-	while (pos != haystack->nil) {
-		if (pos->key == needle) {
-			return pos;
-		} else if (needle < pos->key) {
-			pos = pos->lchild;
+/* Rebuilds a tree into a balanced, correctly colored shape. */
+/* The same shape RBbuild_sorted makes: the keys go into a new block through
+ * rb_build_subtree, and the old nodes go back to the arena. Their keys are
+ * collected by rotating each left child up until there is none, which visits
+ * the nodes in order without using the parent links we overwrite. */
+static int rb_rebuild(rb_tree tree) {
+	struct rb_slab *block;
+	rb_node n, next;
+	int *keys;
+	size_t count = rb_count_nodes(tree), i = 0;
+	int red_depth = 0;
+	if (count == 0) {
+		return 1;
+	}
+	if ((keys = malloc(count * sizeof(*keys))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	if ((block = rb_new_slab(tree, count)) == NULL) {
+		free(keys);
+		return 0;
+	}
+	for (n = tree->root; n != tree->nil; n = next) {
+		next = n->lchild;
+		if (next != tree->nil) {
+			n->lchild = next->rchild;
+			next->rchild = n;
 		} else {
-			pos = pos->rchild;
+			next = n->rchild;
+			keys[i++] = n->key;
+			rb_free_node(tree, n);
 		}
 	}
-	return haystack->nil;
+	while (((size_t)2 << red_depth) - 1 <= count) {
+		red_depth++;
+	}
+	tree->root = rb_build_subtree(tree, block->nodes, keys, 0, count, 0,
+		red_depth);
+	tree->root->parent = tree->nil;
+	free(keys);
+	return 1;
 }
-/* Rotates a tree around the given root. */
-static void rb_rotate(rb_tree tree, rb_node root, int go_left) {
-	/* Instead of duplicating code, we just
-	 * have a flag to indicate the direction to rotate. */
-	/* The new top node */
-	rb_node newroot = (go_left) ? root->rchild : root->lchild;
-	/* We swap the center child and the old top node */
-	if (go_left) {
-		root->rchild = newroot->lchild;
-		if (root->rchild != tree->nil) {
-			root->rchild->parent = root;
-		}
-		newroot->lchild = root;
+/* Helper routine: makes a node for rb_load_preorder. */
+static rb_load_node rb_load_make(void *tree, int key, int red) {
+	rb_node n;
+	if ((n = rb_new_node(tree, key)) == NULL) {
+		return 0;
+	}
+	n->color = red ? 'r' : 'b';
+	return (rb_load_node)n;
+}
+/* Helper routine: links a node for rb_load_preorder. */
+static void rb_load_link(void *t, rb_load_node parent, rb_load_node child,
+		int right) {
+	rb_tree tree = t;
+	rb_node p = (rb_node)parent, n = (rb_node)child;
+	if (p == NULL) {
+		n->color = 'b';
+		tree->root = n;
+	} else if (right) {
+		p->rchild = n;
+		n->parent = p;
 	} else {
-		root->lchild = newroot->rchild;
-		if (root->lchild != tree->nil) {
-			root->lchild->parent = root;
+		p->lchild = n;
+		n->parent = p;
+	}
+}
+/* Writes a tree to file descriptor fd in binary format. */
+int RBwrite_binary(rb_tree tree, int fd) {
+	struct rb_io io;
+	unsigned char rec[16];
+	rb_node n = tree->root;
+	size_t chunk;
+	uint32_t records = 0;
+	int i;
+	io.fd = fd;
+	io.fp = NULL;
+	io.pos = io.len = 0;
+	io.count = io.sum = 0;
+	io.failed = 0;
+	if ((io.buf = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	memcpy(rec, RB_BIN_MAGIC, 4);
+	for (i = 0; i < 4; i++) rec[4 + i] = (unsigned char)(RB_BIN_VERSION >> 8 * i);
+	rb_io_put(&io, rec, 8);
+	/* Each buffer's worth of records is one chunk; its length is filled in
+	 * just before the buffer goes out */
+	chunk = io.len;
+	io.len += 4;
+	for (; n != tree->nil; n = rb_preorder_next(tree, n)) {
+		uint32_t key = (uint32_t)n->key;
+		if (io.len + RB_BIN_RECORD > RB_IO_BUF) {
+			rb_bin_chunk(&io, chunk, records);
+			rb_io_flush(&io);
+			chunk = io.len;
+			io.len += 4;
+			records = 0;
 		}
-		newroot->rchild = root;
+		for (i = 0; i < 4; i++) io.buf[io.len + i] = (unsigned char)(key >> 8 * i);
+		io.buf[io.len + 4] = (unsigned char)n->color;
+		io.len += RB_BIN_RECORD;
+		records++;
+		io.count++;
+		io.sum = rb_bin_mix(io.sum, (uint64_t)key << 8 | (unsigned char)n->color);
 	}
-	/* Now we set up the parent nodes */
-	newroot->parent = root->parent;
-	root->parent = newroot;
-	/* We update old top node's parent to point to the new top node */
-	if (newroot->parent == tree->nil) {
-		tree->root = newroot;
-	} else if (newroot->parent->lchild == root) {
-		newroot->parent->lchild = newroot;
-	} else {
-		newroot->parent->rchild = newroot;
+	/* An empty chunk ends the records; the last one may already be it */
+	rb_bin_chunk(&io, chunk, records);
+	if (records > 0) {
+		memset(rec, 0, 4);
+		rb_io_put(&io, rec, 4);
+	}
+	for (i = 0; i < 8; i++) {
+		rec[i] = (unsigned char)(io.count >> 8 * i);
+		rec[8 + i] = (unsigned char)(io.sum >> 8 * i);
 	}
+	rb_io_put(&io, rec, 16);
+	rb_io_flush(&io);
+	free(io.buf);
+	return !io.failed;
 }
-/* Returns minimum node in the given subtree. */
-static rb_node rb_min(rb_tree tree, rb_node node) {
-	while (node->lchild != tree->nil)
-		node = node->lchild;
-	return node;
+/* Reads a tree in binary format from file descriptor fd. */
+/* The same O(n) reconstruction as RBread, with the nodes coming from the
+ * buffered stream. Nothing is returned until the checksum matches. The
+ * stream reads only as far as the chunk lengths say the tree goes, so
+ * whatever follows it on fd is left there. */
+rb_tree RBread_binary(int fd) {
+	struct rb_io io;
+	rb_tree ret;
+	unsigned char *p;
+	uint64_t count = 0, sum = 0;
+	uint32_t version = 0;
+	int i;
+	io.fd = fd;
+	io.fp = NULL;
+	io.pos = io.len = 0;
+	io.left = 8;
+	io.chunk = 0;
+	io.count = io.sum = 0;
+	io.done = io.failed = 0;
+	if ((io.buf = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	if ((p = rb_io_get(&io, 8)) == NULL || memcmp(p, RB_BIN_MAGIC, 4) != 0) {
+		fprintf(stderr, "Error: not a binary tree file.\n");
+		free(io.buf);
+		return NULL;
+	}
+	for (i = 0; i < 4; i++) version |= (uint32_t)p[4 + i] << 8 * i;
+	io.chunked = (version == RB_BIN_VERSION);
+	/* The first chunk's length; version 1 gives no lengths to go by */
+	io.left = io.chunked ? 4 : UINT64_MAX;
+	if (version != RB_BIN_VERSION && version != 1) {
+		fprintf(stderr, "Error: unsupported binary tree version %lu.\n",
+			(unsigned long)version);
+		free(io.buf);
+		return NULL;
+	}
+	ret = RBcreate();
+	if (ret != NULL) {
+		switch (rb_load_preorder(&rb_tree_load, ret, rb_read_binary_node,
+				&io)) {
+		case RB_READ_UNORDERED:
+			fprintf(stderr, "Error: keys are not in preorder.\n");
+			RBfree(ret);
+			free(io.buf);
+			return NULL;
+		case RB_READ_FAILED:
+			io.failed = 1;
+			break;
+		case RB_READ_REPAIR:
+			if (!io.failed && !rb_rebuild(ret)) io.failed = 1;
+			break;
+		}
+		if (io.done && (p = rb_io_get(&io, 16)) != NULL) {
+			for (i = 0; i < 8; i++) {
+				count |= (uint64_t)p[i] << 8 * i;
+				sum |= (uint64_t)p[8 + i] << 8 * i;
+			}
+		}
+		if (!io.done || io.failed || p == NULL || count != io.count
+				|| sum != io.sum) {
+			fprintf(stderr, "Error: binary tree data is truncated or corrupt.\n");
+			RBfree(ret);
+			ret = NULL;
+		}
+	}
+	free(io.buf);
+	return ret;
 }
-/* Computes height of the tree rooted at node n. */
-static int rb_height(rb_tree tree, rb_node n) {
-	int l, r;
-	if (n == tree->nil) return 0;
-	l = rb_height(tree, n->lchild);
-	r = rb_height(tree, n->rchild);
-	return 1 + ((l > r) ? l : r);
+/* Writes a tree to file fname as an image that RBopen_mapped can use in place. */
+/* One preorder walk along the parent pointers, streaming the nodes out
+ * through an rb_io buffer. A node's right child index is only known once its
+ * left subtree is out, so we keep the index of the node at each depth and
+ * patch its link in then, with rb_image_patch. The header's count is patched
+ * the same way at the end. */
+int RBwrite_image(rb_tree tree, char *fname) {
+	struct rb_io io;
+	struct rb_image_header head;
+	struct rb_image_node img;
+	size_t count = 0, *at = NULL, *tmpat, depth = 0, maxdepth = 0;
+	uint32_t link;
+	rb_node n = tree->root, from;
+	int ok = 1;
+	io.fp = NULL;
+	io.pos = io.len = 0;
+	io.failed = 0;
+	if ((io.buf = malloc(RB_IO_BUF)) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	if ((io.fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "Error: couldn't write file %s.\n", fname);
+		free(io.buf);
+		return 0;
+	}
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, RB_IMAGE_MAGIC, 4);
+	head.version = RB_IMAGE_VERSION;
+	head.order = RB_IMAGE_ORDER;
+	rb_io_put(&io, &head, sizeof(head));
+	while (n != tree->nil && !io.failed) {
+		if (count == (size_t)RB_IMAGE_RIGHT) {
+			fprintf(stderr, "Error: tree too large for an image.\n");
+			ok = 0;
+			break;
+		}
+		if (depth == maxdepth) {
+			maxdepth = maxdepth ? 2 * maxdepth : 64;
+			if ((tmpat = realloc(at, maxdepth * sizeof(*at))) == NULL) {
+				fprintf(stderr, "Error: out of memory.\n");
+				ok = 0;
+				break;
+			}
+			at = tmpat;
+		}
+		at[depth] = count;
+		img.key = n->key;
+		img.link = (n->lchild != tree->nil) ? RB_IMAGE_LEFT : 0;
+		rb_io_put(&io, &img, sizeof(img));
+		count++;
+		rb_prefetch(n->rchild);
+		if (n->lchild != tree->nil) {
+			n = n->lchild;
+			depth++;
+			continue;
+		}
+		/* Climb until we come up from a left child whose sibling is
+		 * still to do, then go right */
+		from = tree->nil;
+		while (n != tree->nil && (n->rchild == tree->nil || n->rchild == from)) {
+			from = n;
+			n = n->parent;
+			depth--;
+		}
+		if (n != tree->nil) {
+			link = (n->lchild != tree->nil) ? RB_IMAGE_LEFT : 0;
+			link |= (uint32_t)count;
+			rb_image_patch(&io, sizeof(head) + count * sizeof(img),
+				sizeof(head) + at[depth] * sizeof(img)
+				+ offsetof(struct rb_image_node, link), &link, sizeof(link));
+			n = n->rchild;
+			depth++;
+		}
+	}
+	free(at);
+	head.count = count;
+	rb_image_patch(&io, sizeof(head) + count * sizeof(img),
+		offsetof(struct rb_image_header, count), &head.count, sizeof(head.count));
+	rb_io_flush(&io);
+	if (io.failed) ok = 0;
+	if (close(io.fd) != 0) ok = 0;
+	if (!ok) fprintf(stderr, "Error: couldn't write file %s.\n", fname);
+	free(io.buf);
+	return ok;
 }
-
-
-
-
-/******************************************************************************
- * Section 6: SVG
- *****************************************************************************/
+/* Helper routine: writes n bytes at offset off of the file that io has had
+ * end bytes put into so far. */
+/* The bytes are patched into the buffer if they're still there, and written
+ * to the file with pwrite if it's gone out already. */
+static void rb_image_patch(struct rb_io *io, size_t end, size_t off,
+		const void *p, size_t n) {
+	size_t out = end - io->len, done = 0;
+	if (off >= out) {
+		memcpy(io->buf + (off - out), p, n);
+		return;
+	}
+	while (done < n && !io->failed) {
+		ssize_t w = pwrite(io->fd, (const char *)p + done, n - done, off + done);
+		if (w < 0 && errno != EINTR) {
+			fprintf(stderr, "Error: write failed.\n");
+			io->failed = 1;
+		} else if (w > 0) {
+			done += w;
+		}
+	}
+}
+/* Helper routine: read a single node from struct rb_io *io. */
+static int rb_read_binary_node(void *src, int *key, int *red) {
+	struct rb_io *io = src;
+	unsigned char *p;
+	uint32_t k = 0;
+	int i;
+	if (io->done || io->failed) return 0;
+	if (io->chunked && io->chunk == 0) {
+		if ((p = rb_io_get(io, 4)) == NULL) {
+			io->failed = 1;
+			return 0;
+		}
+		for (i = 0; i < 4; i++) io->chunk |= (uint32_t)p[i] << 8 * i;
+		if (io->chunk == 0) {
+			/* Only the trailer is left */
+			io->left += 16;
+			io->done = 1;
+			return 0;
+		}
+		/* The chunk's records and the next chunk's length */
+		io->left += (uint64_t)io->chunk * RB_BIN_RECORD + 4;
+	}
+	if ((p = rb_io_get(io, RB_BIN_RECORD)) == NULL) {
+		io->failed = 1;
+		return 0;
+	}
+	if (io->chunked) {
+		io->chunk--;
+	} else if (p[4] == 0) {
+		io->done = 1;
+		return 0;
+	}
+	if (p[4] != 'b' && p[4] != 'r') {
+		io->failed = 1;
+		return 0;
+	}
+	for (i = 0; i < 4; i++) k |= (uint32_t)p[i] << 8 * i;
+	*key = (int)k;
+	*red = (p[4] == 'r');
+	io->count++;
+	io->sum = rb_bin_mix(io->sum, (uint64_t)k << 8 | p[4]);
+	return 1;
+}
+/* Appends n bytes to the output buffer, flushing it as needed. */
+static void rb_io_put(struct rb_io *io, const void *p, size_t n) {
+	if (io->len + n > RB_IO_BUF) rb_io_flush(io);
+	memcpy(io->buf + io->len, p, n);
+	io->len += n;
+}
+/* Writes out everything buffered. */
+static void rb_io_flush(struct rb_io *io) {
+	size_t done = 0;
+	if (io->fp != NULL) {
+		if (io->len > 0 && fwrite(io->buf, 1, io->len, io->fp) != io->len) {
+			fprintf(stderr, "Error: write failed.\n");
+			io->failed = 1;
+		}
+		io->len = 0;
+		return;
+	}
+	while (done < io->len && !io->failed) {
+		ssize_t w = write(io->fd, io->buf + done, io->len - done);
+		if (w < 0 && errno != EINTR) {
+			fprintf(stderr, "Error: write failed.\n");
+			io->failed = 1;
+		} else if (w > 0) {
+			done += w;
+		}
+	}
+	io->len = 0;
+}
+/* Returns a pointer to the next n bytes of input, or NULL if there aren't n. */
+static unsigned char *rb_io_get(struct rb_io *io, size_t n) {
+	unsigned char *ret;
+	if (io->len - io->pos < n) {
+		/* Slide what's left to the front and top up the buffer */
+		memmove(io->buf, io->buf + io->pos, io->len - io->pos);
+		io->len -= io->pos;
+		io->pos = 0;
+		while (io->len < n) {
+			size_t want = RB_IO_BUF - io->len;
+			ssize_t r;
+			if (want > io->left) want = (size_t)io->left;
+			if (want == 0) return NULL;
+			r = read(io->fd, io->buf + io->len, want);
+			if (r == 0 || (r < 0 && errno != EINTR)) return NULL;
+			if (r > 0) {
+				io->len += r;
+				if (io->left != UINT64_MAX) io->left -= r;
+			}
+		}
+	}
+	ret = io->buf + io->pos;
+	io->pos += n;
+	return ret;
+}
+/* Fills in the length of the chunk whose header is at buf[at]. */
+static void rb_bin_chunk(struct rb_io *io, size_t at, uint32_t records) {
+	int i;
+	for (i = 0; i < 4; i++) io->buf[at + i] = (unsigned char)(records >> 8 * i);
+}
+/* Adds one record to a checksum. */
+static uint64_t rb_bin_mix(uint64_t sum, uint64_t rec) {
+	sum = (sum ^ rec) * UINT64_C(0x9e3779b97f4a7c15);
+	return sum ^ (sum >> 29);
+}
+
+
+
+
+/******************************************************************************
+ * Section 5: Searching
+ *****************************************************************************/
+/* Returns nonzero if an element with the given key is in the tree. */
+/* The walk is written out here, rather than left to rb_get_node_by_key, so the
+ * depth can be counted in a register and added once at the end. */
+int RBsearch(rb_tree tree, int key) {
+	rb_node pos = tree->root;
+	size_t depth = 0;
+	while (pos != tree->nil && pos->key != key) {
+		pos = (key < pos->key) ? pos->lchild : pos->rchild;
+		depth++;
+	}
+	RB_STAT_SEARCH(tree, depth);
+	return pos != tree->nil;
+}
+/* Looks up n keys at once. Instead of finishing one descent before starting
+ * the next, we keep RB_SEARCH_LANES descents going and advance each one a
+ * level at a time, prefetching the child it will visit next. By the time we
+ * come back around to a lane its node is (hopefully) in cache. */
+size_t RBsearch_many(rb_tree tree, const int *keys, size_t n, int *out) {
+	rb_node pos[RB_SEARCH_LANES]; /* current node of each lane */
+	size_t which[RB_SEARCH_LANES]; /* index of the key each lane looks for */
+	size_t next = 0;  /* next key to hand to an idle lane */
+	size_t active = 0; /* number of lanes in use */
+	size_t found = 0;
+	size_t i;
+	/* Start up the lanes */
+	while (active < RB_SEARCH_LANES && next < n) {
+		pos[active] = tree->root;
+		which[active] = next++;
+		active++;
+	}
+	rb_prefetch(tree->root);
+	while (active > 0) {
+		for (i = 0; i < active; i++) {
+			rb_node p = pos[i];
+			int key = keys[which[i]];
+			int done = 0;
+			if (p == tree->nil) {
+				if (out != NULL) out[which[i]] = 0;
+				done = 1;
+			} else if (key == p->key) {
+				if (out != NULL) out[which[i]] = 1;
+				found++;
+				done = 1;
+			} else {
+				p = (key < p->key) ? p->lchild : p->rchild;
+				rb_prefetch(p);
+				pos[i] = p;
+			}
+			if (done) {
+				/* Give the lane a new key, or retire it by
+				 * moving the last lane into its slot. */
+				if (next < n) {
+					pos[i] = tree->root;
+					which[i] = next++;
+				} else {
+					active--;
+					pos[i] = pos[active];
+					which[i] = which[active];
+					i--; /* revisit the lane we moved here */
+				}
+			}
+		}
+	}
+	return found;
+}
+/* Smallest element. */
+int RBfirst(rb_tree tree, rb_cursor *cur) {
+	cur->tree = tree;
+	cur->node = (tree->root == tree->nil) ? tree->nil : rb_min(tree, tree->root);
+	return cur->node != tree->nil;
+}
+/* Largest element. */
+int RBlast(rb_tree tree, rb_cursor *cur) {
+	cur->tree = tree;
+	cur->node = (tree->root == tree->nil) ? tree->nil : rb_max(tree, tree->root);
+	return cur->node != tree->nil;
+}
+/* Smallest element with key >= key. */
+int RBlower_bound(rb_tree tree, int key, rb_cursor *cur) {
+	rb_node pos = tree->root;
+	rb_node best = tree->nil; /* smallest node >= key seen so far */
+	while (pos != tree->nil) {
+		if (pos->key >= key) {
+			best = pos;
+			pos = pos->lchild;
+		} else {
+			pos = pos->rchild;
+		}
+	}
+	cur->tree = tree;
+	cur->node = best;
+	return best != tree->nil;
+}
+/* Smallest element with key > key. */
+int RBupper_bound(rb_tree tree, int key, rb_cursor *cur) {
+	rb_node pos = tree->root;
+	rb_node best = tree->nil; /* smallest node > key seen so far */
+	while (pos != tree->nil) {
+		if (pos->key > key) {
+			best = pos;
+			pos = pos->lchild;
+		} else {
+			pos = pos->rchild;
+		}
+	}
+	cur->tree = tree;
+	cur->node = best;
+	return best != tree->nil;
+}
+/* Largest element with key <= key. */
+int RBfloor(rb_tree tree, int key, rb_cursor *cur) {
+	rb_node pos = tree->root;
+	rb_node best = tree->nil; /* largest node <= key seen so far */
+	while (pos != tree->nil) {
+		if (pos->key <= key) {
+			best = pos;
+			pos = pos->rchild;
+		} else {
+			pos = pos->lchild;
+		}
+	}
+	cur->tree = tree;
+	cur->node = best;
+	return best != tree->nil;
+}
+/* Smallest element with key >= key (the same as RBlower_bound). */
+int RBceiling(rb_tree tree, int key, rb_cursor *cur) {
+	return RBlower_bound(tree, key, cur);
+}
+/* Moves to the next element. Each edge is crossed at most twice over a whole
+ * walk, so this is amortized O(1). */
+int RBnext(rb_cursor *cur) {
+	if (cur->node == cur->tree->nil) return 0;
+	cur->node = rb_successor(cur->tree, cur->node);
+	return cur->node != cur->tree->nil;
+}
+/* Moves to the previous element. */
+int RBprev(rb_cursor *cur) {
+	if (cur->node == cur->tree->nil) return 0;
+	cur->node = rb_predecessor(cur->tree, cur->node);
+	return cur->node != cur->tree->nil;
+}
+/* Returns nonzero if the cursor is positioned on an element. */
+int RBcursor_valid(const rb_cursor *cur) {
+	return cur->node != cur->tree->nil;
+}
+/* Returns the key of the element under a valid cursor. */
+int RBcursor_key(const rb_cursor *cur) {
+	return cur->node->key;
+}
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. */
+size_t RBrange(rb_tree tree, int lo, int hi, void (*fn)(int key, void *arg),
+		void *arg) {
+	rb_cursor cur;
+	size_t count = 0;
+	if (lo > hi || !RBlower_bound(tree, lo, &cur)) return 0;
+	do {
+		if (cur.node->key > hi) break;
+		fn(cur.node->key, arg);
+		count++;
+	} while (RBnext(&cur));
+	return count;
+}
+/* Copies up to max keys in [lo, hi] into out, in increasing order. */
+size_t RBrange_keys(rb_tree tree, int lo, int hi, int *out, size_t max) {
+	rb_cursor cur;
+	size_t count = 0;
+	if (lo > hi || max == 0 || !RBlower_bound(tree, lo, &cur)) return 0;
+	do {
+		if (cur.node->key > hi) break;
+		out[count++] = cur.node->key;
+	} while (count < max && RBnext(&cur));
+	return count;
+}
+/* Lock-free lookup, safe to run while another thread writes to the tree. */
+/* Nodes are only ever recycled within the tree's own arena and the nil
+ * sentinel is never written, so whatever a reader runs into is still a
+ * node. It may be a stale one, but then the version has moved on and we
+ * start over. */
+int RBsearch_concurrent(rb_tree tree, int key) {
+	unsigned seq;
+	int found;
+	do {
+		rb_node pos;
+		int steps = 0;
+		seq = rb_read_begin(tree);
+		found = 0;
+		pos = rb_load_node(tree->root);
+		while (pos != tree->nil && pos != NULL) {
+			int k = rb_load_key(pos->key);
+			if (k == key) {
+				found = 1;
+				break;
+			}
+			pos = (key < k) ? rb_load_node(pos->lchild)
+					: rb_load_node(pos->rchild);
+			if (++steps % RB_SEQ_CHECK == 0 && rb_read_stale(tree, seq)) {
+				break;
+			}
+		}
+	} while (rb_read_stale(tree, seq));
+	return found;
+}
+/* Lock-free range scan: copies up to max keys in [lo, hi] into out. */
+size_t RBrange_concurrent(rb_tree tree, int lo, int hi, int *out, size_t max) {
+	unsigned seq;
+	size_t count;
+	if (lo > hi || max == 0) return 0;
+	do {
+		rb_node pos, best;
+		int steps = 0, stale = 0;
+		seq = rb_read_begin(tree);
+		count = 0;
+		/* Find the lower bound */
+		best = tree->nil;
+		pos = rb_load_node(tree->root);
+		while (pos != tree->nil && pos != NULL && !stale) {
+			if (rb_load_key(pos->key) >= lo) {
+				best = pos;
+				pos = rb_load_node(pos->lchild);
+			} else {
+				pos = rb_load_node(pos->rchild);
+			}
+			if (++steps % RB_SEQ_CHECK == 0) {
+				stale = rb_read_stale(tree, seq);
+			}
+		}
+		/* And walk forward from it */
+		pos = best;
+		while (!stale && pos != tree->nil && pos != NULL && count < max) {
+			int k = rb_load_key(pos->key);
+			if (k > hi) break;
+			out[count++] = k;
+			pos = rb_successor_concurrent(tree, pos, seq, &stale);
+		}
+	} while (rb_read_stale(tree, seq));
+	return count;
+}
+/* Helper routine: successor for the lock-free readers. */
+static rb_node rb_successor_concurrent(rb_tree tree, rb_node n, unsigned seq,
+		int *stale) {
+	rb_node next = rb_load_node(n->rchild), up;
+	int steps = 0;
+	if (next != tree->nil) {
+		while (next != NULL && (up = rb_load_node(next->lchild)) != tree->nil) {
+			next = up;
+			if (++steps % RB_SEQ_CHECK == 0 && (*stale = rb_read_stale(tree, seq))) {
+				return NULL;
+			}
+		}
+		return next;
+	}
+	up = rb_load_node(n->parent);
+	while (up != tree->nil && up != NULL && n == rb_load_node(up->rchild)) {
+		n = up;
+		up = rb_load_node(up->parent);
+		if (++steps % RB_SEQ_CHECK == 0 && (*stale = rb_read_stale(tree, seq))) {
+			return NULL;
+		}
+	}
+	return up;
+}
+
+
+
+
+/******************************************************************************
+ * Section 6: General helper routines
+ *****************************************************************************/
+/* Checks that a tree is a valid Red-Black tree. */
+/* A walk along the parent pointers, keeping count of the black nodes between
+ * the root and where we are, so it needs no stack however bad the tree. */
+int RBverify(rb_tree tree) {
+	rb_node n = tree->root, from = tree->nil, prev = tree->nil;
+	int depth = 1, black = -1;
+	if (n == tree->nil) return 1;
+	if (n->color != 'b' || n->parent != tree->nil) {
+		fprintf(stderr, "Error: bad root.\n");
+		return 0;
+	}
+	while (n != tree->nil) {
+		rb_node next = tree->nil;
+		if (from == n->parent && n->lchild != tree->nil) {
+			/* Arrived from above: go left */
+			next = n->lchild;
+		} else if (from == n->parent || from == n->lchild) {
+			/* Left side done: n comes next in order, then go right */
+			if (prev != tree->nil && prev->key >= n->key) {
+				fprintf(stderr, "Error: node %i out of order.\n", n->key);
+				return 0;
+			}
+			prev = n;
+			if (n->lchild == tree->nil || n->rchild == tree->nil) {
+				if (black < 0) black = depth;
+				if (depth != black) {
+					fprintf(stderr, "Error: black height differs "
+						"below node %i.\n", n->key);
+					return 0;
+				}
+			}
+			next = n->rchild;
+		} /* Otherwise we arrived from the right: go up */
+		if (next != tree->nil) {
+			if (next->parent != n) {
+				fprintf(stderr, "Error: node %i has the wrong parent.\n",
+					next->key);
+				return 0;
+			}
+			if (next->color == 'r' && n->color == 'r') {
+				fprintf(stderr, "Error: red node %i has a red parent.\n",
+					next->key);
+				return 0;
+			}
+			if (next->color != 'r' && next->color != 'b') {
+				fprintf(stderr, "Error: node %i has no color.\n", next->key);
+				return 0;
+			}
+			depth += (next->color == 'b');
+			from = n;
+			n = next;
+		} else {
+			depth -= (n->color == 'b');
+			from = n;
+			n = n->parent;
+		}
+	}
+	return 1;
+}
+/* Fills in the statistics for a tree. */
+void RBstats(rb_tree tree, struct rb_stats *out) {
+	rb_node n;
+	int i;
+	out->nodes = rb_count_nodes(tree);
+	out->height = rb_height(tree, tree->root);
+	/* Every path has the same number of black nodes, so take the leftmost */
+	out->black_height = 0;
+	for (n = tree->root; n != tree->nil; n = n->lchild) {
+		out->black_height += (n->color == 'b');
+	}
+	out->inserts = tree->stats.inserts;
+	out->deletes = tree->stats.deletes;
+	out->rotations = tree->stats.rotations;
+	for (i = 0; i < 3; i++) {
+		out->insert_case[i] = tree->stats.insert_case[i];
+	}
+	for (i = 0; i < 4; i++) {
+		out->delete_case[i] = tree->stats.delete_case[i];
+	}
+	out->pool_hits = tree->stats.pool_hits;
+	out->pool_fresh = tree->stats.pool_fresh;
+	out->slab_reuses = tree->stats.slab_reuses;
+	out->slab_mallocs = tree->stats.slab_mallocs;
+	out->searches = out->search_steps = 0;
+	for (i = 0; i < RB_STAT_SLOTS; i++) {
+		out->searches += atomic_load_explicit(&tree->stats.search[i].searches,
+			memory_order_relaxed);
+		out->search_steps += atomic_load_explicit(&tree->stats.search[i].steps,
+			memory_order_relaxed);
+	}
+}
+/* Returns a node with the given key. */
+static rb_node rb_get_node_by_key(rb_tree haystack, int needle) {
+	rb_node pos = haystack->root; /* our current position */
+	while (pos != haystack->nil) {
+		if (pos->key == needle) {
+			return pos;
+		} else if (needle < pos->key) {
+			pos = pos->lchild;
+		} else {
+			pos = pos->rchild;
+		}
+	}
+	return haystack->nil;
+}
+#ifndef RB_NO_STATS
+/* Counts a search of tree that stepped past steps nodes. */
+/* A slot held by this thread alone takes a plain load and store, which is
+ * far cheaper than a locked add; only the shared slot needs the latter. */
+static void rb_stat_search(rb_tree tree, size_t steps) {
+	struct rb_search_counts *c;
+	if (rb_stat_self == 0) rb_stat_claim();
+	c = &tree->stats.search[rb_stat_self - 1];
+	if (rb_stat_self < RB_STAT_SLOTS) {
+		atomic_store_explicit(&c->searches, atomic_load_explicit(&c->searches,
+			memory_order_relaxed) + 1, memory_order_relaxed);
+		atomic_store_explicit(&c->steps, atomic_load_explicit(&c->steps,
+			memory_order_relaxed) + steps, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&c->searches, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&c->steps, steps, memory_order_relaxed);
+	}
+}
+/* Gives this thread a search counter slot, its own if one is free. */
+/* A thread keeps its slot, for every tree, until it exits. Threads that
+ * find none free use the shared last slot from then on. */
+static void rb_stat_claim() {
+	unsigned held = atomic_load(&rb_stat_held), i;
+	pthread_once(&rb_stat_once, rb_stat_init);
+	do {
+		for (i = 0; i < RB_STAT_SLOTS - 1 && (held >> i & 1); i++);
+		if (i == RB_STAT_SLOTS - 1) {
+			rb_stat_self = RB_STAT_SLOTS;
+			return;
+		}
+	} while (!atomic_compare_exchange_weak(&rb_stat_held, &held, held | 1u << i));
+	rb_stat_self = i + 1;
+	pthread_setspecific(rb_stat_key, (void *)(uintptr_t)rb_stat_self);
+}
+/* Creates the key whose destructor frees a thread's slot. */
+static void rb_stat_init() {
+	pthread_key_create(&rb_stat_key, rb_stat_exit);
+}
+/* Frees an exiting thread's search counter slot. */
+static void rb_stat_exit(void *slot) {
+	atomic_fetch_and(&rb_stat_held, ~(1u << ((uintptr_t)slot - 1)));
+	rb_stat_self = 0;
+}
+#endif
+/* Rotates a tree around the given root. */
+static void rb_rotate(rb_tree tree, rb_node root, int go_left) {
+	/* Instead of duplicating code, we just
+	 * have a flag to indicate the direction to rotate. */
+	/* The new top node */
+	rb_node newroot = (go_left) ? root->rchild : root->lchild;
+	RB_STAT(tree, rotations);
+	RB_TRACE_EVENT(2, tree, RB_TRACE_ROTATE, go_left, root->key);
+	/* We swap the center child and the old top node */
+	if (go_left) {
+		root->rchild = newroot->lchild;
+		if (root->rchild != tree->nil) {
+			root->rchild->parent = root;
+		}
+		newroot->lchild = root;
+	} else {
+		root->lchild = newroot->rchild;
+		if (root->lchild != tree->nil) {
+			root->lchild->parent = root;
+		}
+		newroot->rchild = root;
+	}
+	/* Now we set up the parent nodes */
+	newroot->parent = root->parent;
+	root->parent = newroot;
+	/* We update old top node's parent to point to the new top node */
+	if (newroot->parent == tree->nil) {
+		tree->root = newroot;
+	} else if (newroot->parent->lchild == root) {
+		newroot->parent->lchild = newroot;
+	} else {
+		newroot->parent->rchild = newroot;
+	}
+}
+/* Marks the start of a change that lock-free readers could see. */
+/* This is the writer half of a sequence lock: the version is odd while the
+ * tree is being changed. Readers never block us. */
+static void rb_write_begin(rb_tree tree) {
+	unsigned seq = atomic_load_explicit(&tree->seq, memory_order_relaxed);
+	atomic_store_explicit(&tree->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+/* Marks the end of a change. */
+static void rb_write_end(rb_tree tree) {
+	unsigned seq = atomic_load_explicit(&tree->seq, memory_order_relaxed);
+	atomic_store_explicit(&tree->seq, seq + 1, memory_order_release);
+}
+/* Waits for a moment when no write is in progress and returns the version. */
+static unsigned rb_read_begin(rb_tree tree) {
+	unsigned seq;
+	while ((seq = atomic_load_explicit(&tree->seq, memory_order_acquire)) & 1) {
+		sched_yield();
+	}
+	return seq;
+}
+/* Returns nonzero if the tree has changed since version seq. */
+static int rb_read_stale(rb_tree tree, unsigned seq) {
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&tree->seq, memory_order_relaxed) != seq;
+}
+/* Returns minimum node in the given subtree. */
+static rb_node rb_min(rb_tree tree, rb_node node) {
+	while (node->lchild != tree->nil)
+		node = node->lchild;
+	return node;
+}
+/* Returns maximum node in the given subtree. */
+static rb_node rb_max(rb_tree tree, rb_node node) {
+	while (node->rchild != tree->nil)
+		node = node->rchild;
+	return node;
+}
+/* Returns the in-order successor of a node, or tree->nil if it has none. */
+static rb_node rb_successor(rb_tree tree, rb_node node) {
+	rb_node up;
+	if (node->rchild != tree->nil) {
+		return rb_min(tree, node->rchild);
+	}
+	/* Climb until we come up out of a left subtree */
+	up = node->parent;
+	while (up != tree->nil && node == up->rchild) {
+		node = up;
+		up = up->parent;
+	}
+	return up;
+}
+/* Returns the in-order predecessor of a node, or tree->nil if it has none. */
+static rb_node rb_predecessor(rb_tree tree, rb_node node) {
+	rb_node up;
+	if (node->lchild != tree->nil) {
+		return rb_max(tree, node->lchild);
+	}
+	/* Climb until we come up out of a right subtree */
+	up = node->parent;
+	while (up != tree->nil && node == up->lchild) {
+		node = up;
+		up = up->parent;
+	}
+	return up;
+}
+/* Computes height of the tree rooted at node n. */
+static int rb_height(rb_tree tree, rb_node n) {
+	int l, r;
+	if (n == tree->nil) return 0;
+	l = rb_height(tree, n->lchild);
+	r = rb_height(tree, n->rchild);
+	return 1 + ((l > r) ? l : r);
+}
+
+
+
+
+/******************************************************************************
+ * Section 7: SVG
+ *****************************************************************************/
 /* Draws an SVG picture of the tree in the specified file. */
 void RBdraw(rb_tree tree, char *fname) {
 	FILE *fp; /* file to print to */
@@ -506,3 +1868,939 @@ static double calcpos(int exp, int rowpos, double factor) {
 	/* This equation took quite a bit of diagramming on paper to come up with. */
 	return ((1<<exp) * (2*rowpos+1) - 1) * (RADIUS + PADDING/2) * factor + RADIUS + IMGBORDER;
 }
+
+
+
+
+/******************************************************************************
+ * Section 8: Bucketed trees
+ *****************************************************************************/
+/* The Red-Black machinery here is exactly the one above, run on the nodes
+ * embedded in the buckets. Each bucket covers the keys from its smallest up to
+ * the next bucket's smallest; a full bucket splits in two and a bucket that
+ * gets too empty merges with a neighbour. */
+/* Creates an empty bucketed tree. */
+rb_btree RBbucket_create() {
+	rb_btree ret;
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	rb_init_tree(&ret->tree);
+	ret->first = NULL;
+	ret->count = 0;
+	ret->nbuckets = 0;
+	return ret;
+}
+/* Frees an entire bucketed tree. */
+void RBbucket_free(rb_btree bt) {
+	while (bt->first != NULL) {
+		struct rb_bucket *next = bt->first->next;
+		free(bt->first);
+		bt->first = next;
+	}
+	free(bt);
+}
+/* Inserts an element with specified key. */
+int RBbucket_insert(rb_btree bt, int key) {
+	struct rb_bucket *b = rb_bucket_find(bt, key);
+	int pos;
+	if (b == NULL) {
+		/* The first key of all */
+		if ((b = rb_bucket_new()) == NULL) return 0;
+		b->keys[0] = key;
+		b->count = 1;
+		rb_bucket_link(bt, b, NULL);
+		bt->count++;
+		return 1;
+	}
+	pos = rb_bucket_rank(b, key);
+	if (pos < b->count && b->keys[pos] == key) {
+		fprintf(stderr, "Error: node %i already in the tree.\n", key);
+		return 0;
+	}
+	if (b->count == RB_BUCKET_KEYS) {
+		/* Full: move the top half into a new bucket after this one */
+		struct rb_bucket *nb = rb_bucket_new();
+		int half = RB_BUCKET_KEYS / 2, i;
+		if (nb == NULL) return 0;
+		memcpy(nb->keys, b->keys + half, half * sizeof(int));
+		nb->count = half;
+		for (i = half; i < RB_BUCKET_KEYS; i++) b->keys[i] = INT_MAX;
+		b->count = half;
+		rb_bucket_link(bt, nb, b);
+		if (pos > half) {
+			b = nb;
+			pos -= half;
+		}
+	}
+	memmove(b->keys + pos + 1, b->keys + pos, (b->count - pos) * sizeof(int));
+	b->keys[pos] = key;
+	b->count++;
+	/* Only possible in the first bucket, so the order is kept */
+	if (pos == 0) b->node.key = key;
+	bt->count++;
+	return 1;
+}
+/* Deletes an element with a particular key. */
+int RBbucket_delete(rb_btree bt, int key) {
+	struct rb_bucket *b = rb_bucket_find(bt, key), *next;
+	int pos;
+	if (b == NULL || (pos = rb_bucket_rank(b, key)) == b->count
+			|| b->keys[pos] != key) {
+		fprintf(stderr, "Error: node %i does not exist.\n", key);
+		return 0;
+	}
+	memmove(b->keys + pos, b->keys + pos + 1, (b->count - pos - 1) * sizeof(int));
+	b->keys[--b->count] = INT_MAX;
+	bt->count--;
+	if (b->count == 0) {
+		rb_bucket_unlink(bt, b);
+		return 1;
+	}
+	if (pos == 0) b->node.key = b->keys[0];
+	/* Merge a quarter-full bucket into its neighbour if the result would
+	 * leave room to grow, so we don't split again straight away. */
+	if (b->count <= RB_BUCKET_KEYS / 4) {
+		if (b->prev != NULL && b->prev->count + b->count <= RB_BUCKET_KEYS * 3 / 4) {
+			next = b;
+			b = b->prev;
+		} else {
+			next = b->next;
+		}
+		if (next != NULL && b->count + next->count <= RB_BUCKET_KEYS * 3 / 4) {
+			memcpy(b->keys + b->count, next->keys, next->count * sizeof(int));
+			b->count += next->count;
+			rb_bucket_unlink(bt, next);
+		}
+	}
+	return 1;
+}
+/* Returns nonzero if an element with the given key is present. */
+int RBbucket_search(rb_btree bt, int key) {
+	struct rb_bucket *b = rb_bucket_find(bt, key);
+	int pos;
+	if (b == NULL) return 0;
+	pos = rb_bucket_rank(b, key);
+	return pos < b->count && b->keys[pos] == key;
+}
+/* Returns the number of elements. */
+size_t RBbucket_size(rb_btree bt) {
+	return bt->count;
+}
+/* Returns the number of bytes the tree is using. */
+size_t RBbucket_memory(rb_btree bt) {
+	return sizeof(*bt) + bt->nbuckets * sizeof(struct rb_bucket);
+}
+/* Returns the bucket whose range key falls in. */
+/* Only the embedded nodes are touched on the way down; the keys of just one
+ * bucket are read at the end. */
+static struct rb_bucket *rb_bucket_find(rb_btree bt, int key) {
+	rb_tree tree = &bt->tree;
+	rb_node pos = tree->root, best = tree->nil;
+	while (pos != tree->nil) {
+		if (pos->key <= key) {
+			best = pos;
+			pos = pos->rchild;
+		} else {
+			pos = pos->lchild;
+		}
+	}
+	if (best == tree->nil) {
+		return bt->first;
+	}
+	return rb_bucket_of(best);
+}
+/* Returns the number of keys in a bucket less than key. */
+/* Compare key against the whole block at once and count the hits. Unused
+ * slots hold INT_MAX, which is never less than key. */
+static int rb_bucket_rank(const struct rb_bucket *b, int key) {
+	int rank = 0, i;
+#if defined(__AVX2__)
+	__m256i x = _mm256_set1_epi32(key);
+	for (i = 0; i < b->count; i += 8) {
+		__m256i lt = _mm256_cmpgt_epi32(x,
+				_mm256_load_si256((const __m256i *)(b->keys + i)));
+		rank += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+	}
+#elif defined(__SSE2__)
+	__m128i x = _mm_set1_epi32(key);
+	for (i = 0; i < b->count; i += 4) {
+		__m128i lt = _mm_cmpgt_epi32(x,
+				_mm_load_si128((const __m128i *)(b->keys + i)));
+		rank += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+	}
+#else
+	for (i = 0; i < b->count; i++) {
+		rank += b->keys[i] < key;
+	}
+#endif
+	return rank;
+}
+/* Allocates an empty bucket. */
+static struct rb_bucket *rb_bucket_new() {
+	struct rb_bucket *ret;
+	int i;
+	if ((ret = aligned_alloc(_Alignof(struct rb_bucket), sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	for (i = 0; i < RB_BUCKET_KEYS; i++) ret->keys[i] = INT_MAX;
+	ret->count = 0;
+	return ret;
+}
+/* Adds a bucket to the tree after prev (or first, if prev is NULL). */
+static void rb_bucket_link(rb_btree bt, struct rb_bucket *b,
+		struct rb_bucket *prev) {
+	rb_tree tree = &bt->tree;
+	rb_node parent = tree->nil, pos = tree->root;
+	b->node.key = b->keys[0];
+	b->node.lchild = b->node.rchild = tree->nil;
+	b->node.color = 'r';
+	while (pos != tree->nil) {
+		parent = pos;
+		pos = (b->node.key < pos->key) ? pos->lchild : pos->rchild;
+	}
+	rb_link_node(tree, &b->node, parent);
+	b->prev = prev;
+	b->next = (prev != NULL) ? prev->next : bt->first;
+	if (b->next != NULL) b->next->prev = b;
+	if (prev != NULL) {
+		prev->next = b;
+	} else {
+		bt->first = b;
+	}
+	bt->nbuckets++;
+}
+/* Removes a bucket from the tree and frees it. */
+static void rb_bucket_unlink(rb_btree bt, struct rb_bucket *b) {
+	rb_unlink_node(&bt->tree, &b->node);
+	if (b->prev != NULL) {
+		b->prev->next = b->next;
+	} else {
+		bt->first = b->next;
+	}
+	if (b->next != NULL) b->next->prev = b->prev;
+	bt->nbuckets--;
+	free(b);
+}
+
+
+
+
+/******************************************************************************
+ * Section 9: Mapped images
+ *****************************************************************************/
+/* Maps the image in file fname. */
+/* Only the header is checked, so opening costs the same for any size. */
+rb_mapped RBopen_mapped(char *fname) {
+	rb_mapped ret;
+	struct stat st;
+	const struct rb_image_header *head;
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error: couldn't read file %s.\n", fname);
+		return NULL;
+	}
+	if ((ret = malloc(sizeof(*ret))) == NULL) {
+		fprintf(stderr, "Error: out of memory.\n");
+		close(fd);
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*head)
+			|| (ret->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+				== MAP_FAILED) {
+		fprintf(stderr, "Error: couldn't map file %s.\n", fname);
+		close(fd);
+		free(ret);
+		return NULL;
+	}
+	/* The mapping outlives the descriptor */
+	close(fd);
+	ret->map_len = st.st_size;
+	head = ret->map;
+	if (memcmp(head->magic, RB_IMAGE_MAGIC, 4) != 0
+			|| head->version != RB_IMAGE_VERSION
+			|| head->order != RB_IMAGE_ORDER
+			|| head->count > RB_IMAGE_RIGHT
+			|| ret->map_len != sizeof(*head)
+				+ head->count * sizeof(struct rb_image_node)) {
+		fprintf(stderr, "Error: %s is not a tree image for this host.\n", fname);
+		munmap(ret->map, ret->map_len);
+		free(ret);
+		return NULL;
+	}
+	ret->nodes = (const struct rb_image_node *)(head + 1);
+	ret->count = head->count;
+	return ret;
+}
+/* Unmaps an image. */
+void RBclose_mapped(rb_mapped m) {
+	munmap(m->map, m->map_len);
+	free(m);
+}
+/* Returns nonzero if an element with the given key is present. */
+int RBmapped_search(rb_mapped m, int key) {
+	size_t i = 0, next;
+	if (m->count == 0) return 0;
+	for (;;) {
+		const struct rb_image_node *n = m->nodes + i;
+		if (key == n->key) {
+			return 1;
+		} else if (key < n->key) {
+			if (!(n->link & RB_IMAGE_LEFT)) return 0;
+			next = i + 1;
+		} else {
+			next = n->link & RB_IMAGE_RIGHT;
+		}
+		/* Links only point forwards; anything else is the end or damage */
+		if (next <= i || next >= m->count) return 0;
+		i = next;
+	}
+}
+/* Returns the number of elements. */
+size_t RBmapped_size(rb_mapped m) {
+	return m->count;
+}
+
+
+
+
+/******************************************************************************
+ * Section 10: Tracing
+ *****************************************************************************/
+/* Sets the hook called for every event. */
+void RBtrace_hook(void (*fn)(const struct rb_trace_event *e, void *arg),
+		void *arg) {
+	rb_trace_fn = fn;
+	rb_trace_arg = arg;
+	atomic_store(&rb_tracing, fn != NULL ||
+		atomic_load(&rb_trace_recording));
+}
+/* Starts or stops recording events in the ring. */
+void RBtrace_record(int on) {
+	atomic_store(&rb_trace_recording, on != 0);
+	atomic_store(&rb_tracing, rb_trace_fn != NULL || on);
+}
+/* Copies recorded events out of the ring. */
+/* The same dance as the lock-free tree readers: check a slot's version, copy
+ * the event, and check the version again in case a writer lapped us. */
+size_t RBtrace_read(struct rb_trace_event *out, size_t max,
+		unsigned long long *next) {
+	unsigned long long end = atomic_load(&rb_trace_next);
+	unsigned long long i = *next;
+	size_t copied = 0;
+	/* Anything more than a ring's length back has been overwritten */
+	if (i + RB_TRACE_RING < end) {
+		i = end - RB_TRACE_RING;
+	}
+	for (; i < end && copied < max; i++) {
+		struct rb_trace_slot *slot = &rb_trace_ring[i & (RB_TRACE_RING - 1)];
+		unsigned long long seq = atomic_load_explicit(&slot->seq,
+			memory_order_acquire);
+		if (seq < i + 1) {
+			/* Still being written: stop here and pick it up next time */
+			break;
+		} else if (seq > i + 1) {
+			/* Overwritten already */
+			continue;
+		}
+		out[copied] = slot->event;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+			copied++;
+		}
+	}
+	*next = i;
+	return copied;
+}
+/* Writes an event to fp on one line. */
+void RBtrace_print(const struct rb_trace_event *e, void *fp) {
+	static const char *names[] = {
+		"insert", "delete", "insert case", "delete case", "rotate",
+		"alloc", "free"
+	};
+	if (e->seq != 0) {
+		fprintf(fp, "%llu ", e->seq);
+	}
+	fprintf(fp, "%p %s", (void *)e->tree, names[e->op]);
+	if (e->op == RB_TRACE_INSERT_CASE || e->op == RB_TRACE_DELETE_CASE) {
+		fprintf(fp, " %d", e->arg);
+	} else if (e->op == RB_TRACE_ROTATE) {
+		fprintf(fp, " %s", (e->arg) ? "left" : "right");
+	}
+	fprintf(fp, " at %d\n", e->key);
+}
+/* Reports an event to the hook and the ring. */
+static void rb_trace(rb_tree tree, int op, int arg, int key) {
+	struct rb_trace_event e;
+	e.seq = 0;
+	e.tree = tree;
+	e.op = op;
+	e.arg = arg;
+	e.key = key;
+	if (atomic_load_explicit(&rb_trace_recording, memory_order_relaxed)) {
+		struct rb_trace_slot *slot;
+		/* Only recorded events are numbered, so every number has a slot */
+		unsigned long long i = atomic_fetch_add_explicit(&rb_trace_next, 1,
+			memory_order_relaxed);
+		slot = &rb_trace_ring[i & (RB_TRACE_RING - 1)];
+		e.seq = i + 1;
+		atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		slot->event = e;
+		atomic_store_explicit(&slot->seq, e.seq, memory_order_release);
+	}
+	if (rb_trace_fn != NULL) {
+		rb_trace_fn(&e, rb_trace_arg);
+	}
+}
+
+
+
+
+/******************************************************************************
+ * Section 11: Splitting and joining
+ *****************************************************************************/
+/* Both work on whole subtrees, so no node is copied or moved: only the
+ * O(log n) nodes along one path are relinked. Afterwards each tree may have
+ * nodes from the other's slabs, so the slabs go into a shared rb_arena that
+ * lasts until every tree using it has been freed. */
+/* Splits a tree into the keys below key and the rest. */
+int RBsplit(rb_tree tree, int key, rb_tree *lo, rb_tree *hi) {
+	rb_tree other;
+	struct rb_arena *arena;
+	rb_node l, r, match;
+	int lbh, rbh;
+	/* Allocate everything first, so a failure leaves the tree as it was */
+	if ((other = RBcreate()) == NULL) {
+		return 0;
+	}
+	if ((arena = rb_arena_new()) == NULL) {
+		RBfree(other);
+		return 0;
+	}
+	rb_split_subtree(tree, tree->root, rb_black_height(tree, tree->root),
+		key, &l, &lbh, &match, &r, &rbh);
+	if (match != tree->nil) {
+		/* key itself goes with the keys above it */
+		r = rb_join_subtrees(other, tree->nil, 0, match, r, rbh, &rbh);
+	}
+	/* The roots may be left red or pointing at their old parents */
+	if (l != tree->nil) {
+		l->parent = tree->nil;
+		l->color = 'b';
+	}
+	if (r != tree->nil) {
+		r->parent = tree->nil;
+		r->color = 'b';
+	}
+	if (l == tree->nil || r == tree->nil) {
+		/* Everything went one way, so the nodes can stay put */
+		free(arena);
+		tree->root = (l == tree->nil) ? r : l;
+		other->root = other->nil;
+		*lo = (l == tree->nil) ? other : tree;
+		*hi = (l == tree->nil) ? tree : other;
+		return 1;
+	}
+	/* The arena takes over the tree's slabs and the arena it already had */
+	arena->slabs = tree->slabs;
+	arena->parents[0] = tree->shared;
+	atomic_store(&arena->refs, 2);
+	tree->slabs = NULL;
+	tree->shared = arena;
+	other->shared = arena;
+	tree->root = l;
+	other->root = r;
+	*lo = tree;
+	*hi = other;
+	return 1;
+}
+/* Joins two trees and a key between them. */
+/* The result is lo, which takes over hi's slabs (in a new arena, along with
+ * both trees' old arenas), so lo's own slabs and free nodes carry on as they
+ * were. */
+rb_tree RBjoin(rb_tree lo, int pivot, rb_tree hi) {
+	struct rb_arena *arena = NULL;
+	rb_node m;
+	int bh;
+	if ((lo->root != lo->nil && rb_max(lo, lo->root)->key >= pivot) ||
+	    (hi->root != hi->nil && rb_min(hi, hi->root)->key <= pivot)) {
+		fprintf(stderr, "Error: pivot %i is not between the trees.\n",
+			pivot);
+		return NULL;
+	}
+	/* Allocate everything first, so a failure leaves the trees as they
+	 * were */
+	if (rb_has_slabs(hi) && (arena = rb_arena_new()) == NULL) {
+		return NULL;
+	}
+	if ((m = rb_new_node(lo, pivot)) == NULL) {
+		free(arena);
+		return NULL;
+	}
+	lo->root = rb_join_subtrees(lo, lo->root, rb_black_height(lo, lo->root),
+		m, hi->root, rb_black_height(hi, hi->root), &bh);
+	rb_take_slabs(lo, hi, arena);
+	RBfree(hi);
+	return lo;
+}
+/* Deletes every element with a key in [lo, hi]. */
+/* Split below lo, then split what is left below hi, and join the outer pieces
+ * back together; the nodes with keys lo and hi, if any, come out of the splits
+ * on their own. Readers only need to be kept off while the links change: once
+ * the range is cut out, none can reach it without seeing a new version, so
+ * the nodes are freed after the write is over. */
+size_t RBdelete_range(rb_tree tree, int lo, int hi) {
+	rb_node l, r, mid, first, last;
+	int lbh, rbh, midbh, bh;
+	size_t count = 0, i;
+	rb_cursor cur;
+	if (lo > hi || !RBlower_bound(tree, lo, &cur)) {
+		return 0;
+	}
+	/* A few keys are quicker to delete one at a time */
+	for (l = cur.node; l != tree->nil && l->key <= hi
+			&& count < RB_RANGE_SPLIT; l = rb_successor(tree, l)) {
+		count++;
+	}
+	if (l == tree->nil || l->key > hi) {
+		/* Unlinking a node with two children moves the successor node
+		 * into its place, so the next node is still the one to go */
+		for (i = 0, l = cur.node; i < count; i++, l = r) {
+			r = rb_successor(tree, l);
+			rb_unlink_node(tree, l);
+			rb_free_node(tree, l);
+		}
+		return count;
+	}
+	count = 0;
+	rb_write_begin(tree);
+	rb_split_subtree(tree, tree->root, rb_black_height(tree, tree->root),
+		lo, &l, &lbh, &first, &r, &rbh);
+	rb_split_subtree(tree, r, rbh, hi, &mid, &midbh, &last, &r, &rbh);
+	tree->root = rb_join2_subtrees(tree, l, lbh, r, rbh, &bh);
+	/* The root may be left red or pointing at its old parent */
+	if (tree->root != tree->nil) {
+		tree->root->parent = tree->nil;
+		tree->root->color = 'b';
+	}
+	rb_write_end(tree);
+	/* first and last came out alone; their links are stale */
+	if (first != tree->nil) {
+		first->lchild = first->rchild = tree->nil;
+		count += rb_free_subtree(tree, first);
+	}
+	if (last != tree->nil) {
+		last->lchild = last->rchild = tree->nil;
+		count += rb_free_subtree(tree, last);
+	}
+	return count + rb_free_subtree(tree, mid);
+}
+/* Gives every node of a detached subtree back to the tree's arena. */
+/* Rotating each left child up until there is none lines the subtree up along
+ * the right, so it can be freed front to back with no stack. */
+static size_t rb_free_subtree(rb_tree tree, rb_node n) {
+	size_t count = 0;
+	while (n != tree->nil) {
+		rb_node next = n->lchild;
+		if (next != tree->nil) {
+			n->lchild = next->rchild;
+			next->rchild = n;
+		} else {
+			next = n->rchild;
+			RB_STAT(tree, deletes);
+			RB_TRACE_EVENT(1, tree, RB_TRACE_DELETE, 0, n->key);
+			rb_free_node(tree, n);
+			count++;
+		}
+		n = next;
+	}
+	return count;
+}
+/* Moves other's slabs into tree. */
+static void rb_take_slabs(rb_tree tree, rb_tree other, struct rb_arena *arena) {
+	if (arena == NULL) return;
+	arena->slabs = other->slabs;
+	arena->parents[0] = tree->shared;
+	arena->parents[1] = other->shared;
+	tree->shared = arena;
+	other->slabs = NULL;
+	other->shared = NULL;
+}
+/* Returns the black height of the subtree at n. */
+/* Every path has the same number of black nodes, so take the leftmost */
+static int rb_black_height(rb_tree tree, rb_node n) {
+	int bh = 0;
+	for (; n != tree->nil; n = n->lchild) {
+		bh += (n->color == 'b');
+	}
+	return bh;
+}
+/* Helper routine: splits the subtree at n. */
+/* Going down, each node goes to the side key puts it on, along with its
+ * subtree on that side, and we recurse into the other subtree. Coming back up
+ * the pieces are joined, shortest first; each join costs about the difference
+ * in black height between the pieces, and these add up to O(log n). */
+static void rb_split_subtree(rb_tree tree, rb_node n, int bh, int key,
+		rb_node *lo, int *lobh, rb_node *match, rb_node *hi, int *hibh) {
+	/* Black height of n's children */
+	int cbh = bh - (n->color == 'b');
+	if (n == tree->nil) {
+		*lo = *hi = *match = tree->nil;
+		*lobh = *hibh = 0;
+	} else if (key == n->key) {
+		*lo = n->lchild;
+		*hi = n->rchild;
+		*lobh = *hibh = cbh;
+		*match = n;
+	} else if (key < n->key) {
+		rb_split_subtree(tree, n->lchild, cbh, key, lo, lobh, match, hi, hibh);
+		*hi = rb_join_subtrees(tree, *hi, *hibh, n, n->rchild, cbh, hibh);
+	} else {
+		rb_split_subtree(tree, n->rchild, cbh, key, lo, lobh, match, hi, hibh);
+		*lo = rb_join_subtrees(tree, n->lchild, cbh, n, *lo, *lobh, lobh);
+	}
+}
+/* Helper routine: joins subtrees l and r with nothing between them. */
+/* r's smallest node is split off to go between them. */
+static rb_node rb_join2_subtrees(rb_tree tree, rb_node l, int lbh, rb_node r,
+		int rbh, int *bh) {
+	rb_node m, empty;
+	int ebh;
+	if (l == tree->nil) {
+		*bh = rbh;
+		return r;
+	} else if (r == tree->nil) {
+		*bh = lbh;
+		return l;
+	}
+	rb_split_subtree(tree, r, rbh, rb_min(tree, r)->key, &empty, &ebh, &m,
+		&r, &rbh);
+	return rb_join_subtrees(tree, l, lbh, m, r, rbh, bh);
+}
+/* Helper routine: joins subtrees l and r with m between them. */
+/* If they are the same black height, m just goes on top. Otherwise we go down
+ * the inner edge of the taller one to a black node c as high as the shorter,
+ * and put m in its place, red, with c and the shorter tree as its children.
+ * Only a red-red pair at m can be wrong then, which is exactly what
+ * rb_insert_fix repairs; tree lends it a root to work with. */
+static rb_node rb_join_subtrees(rb_tree tree, rb_node l, int lbh, rb_node m,
+		rb_node r, int rbh, int *bh) {
+	int go_right; /* is l the taller? */
+	int h, target;
+	rb_node c, p = tree->nil;
+	/* Start from black roots with no parents */
+	if (l != tree->nil) {
+		l->parent = tree->nil;
+		if (l->color == 'r') {
+			l->color = 'b';
+			lbh++;
+		}
+	}
+	if (r != tree->nil) {
+		r->parent = tree->nil;
+		if (r->color == 'r') {
+			r->color = 'b';
+			rbh++;
+		}
+	}
+	if (lbh == rbh) {
+		m->parent = tree->nil;
+		m->lchild = l;
+		m->rchild = r;
+		m->color = 'b';
+		if (l != tree->nil) l->parent = m;
+		if (r != tree->nil) r->parent = m;
+		*bh = lbh + 1;
+		return m;
+	}
+	go_right = (lbh > rbh);
+	c = (go_right) ? l : r;
+	h = (go_right) ? lbh : rbh;
+	target = (go_right) ? rbh : lbh;
+	while (h > target || c->color == 'r') {
+		h -= (c->color == 'b');
+		p = c;
+		c = (go_right) ? c->rchild : c->lchild;
+	}
+	m->parent = p;
+	m->color = 'r';
+	if (go_right) {
+		m->lchild = c;
+		m->rchild = r;
+		p->rchild = m;
+	} else {
+		m->lchild = l;
+		m->rchild = c;
+		p->lchild = m;
+	}
+	if (m->lchild != tree->nil) m->lchild->parent = m;
+	if (m->rchild != tree->nil) m->rchild->parent = m;
+	tree->root = (go_right) ? l : r;
+	rb_insert_fix(tree, m);
+	/* m is on the edge of the tree, so the fixup never rotates at m itself
+	 * (that is case 2) and its subtrees keep their black height. Counting
+	 * up from m gives the height of the whole. */
+	h = target;
+	for (c = m; c != tree->nil; c = c->parent) {
+		h += (c->color == 'b');
+	}
+	*bh = h;
+	return tree->root;
+}
+
+
+
+
+/******************************************************************************
+ * Section 12: Set operations
+ *****************************************************************************/
+/* Union, intersection and difference are built from split and join: split one
+ * tree at the other's root key, combine the halves below and above it
+ * (independently, so on different threads if they are big), and join the two
+ * results. For trees of m <= n keys this is O(m log(n/m + 1)) work, and
+ * O(log n log m) span. */
+/* Returns the union of two trees. */
+rb_tree RBunion(rb_tree a, rb_tree b) {
+	return rb_set_op(a, b, RB_UNION);
+}
+/* Returns the intersection of two trees. */
+rb_tree RBintersect(rb_tree a, rb_tree b) {
+	return rb_set_op(a, b, RB_INTERSECT);
+}
+/* Returns the keys of a that are not in b. */
+rb_tree RBdifference(rb_tree a, rb_tree b) {
+	return rb_set_op(a, b, RB_DIFFERENCE);
+}
+/* Runs a set operation on two whole trees. */
+/* Like RBjoin, the result is a, which takes over b's slabs. Unlike RBjoin, a
+ * always gets a new arena, even if b had no slabs, as the result may hold
+ * nodes from b's own shared arena. The nodes left out of the result, from
+ * either tree, go on a's free list once the tasks are done. */
+static rb_tree rb_set_op(rb_tree a, rb_tree b, int op) {
+	struct rb_arena *arena;
+	struct rb_set_task t;
+	rb_node n, next;
+	if ((arena = rb_arena_new()) == NULL) {
+		return NULL;
+	}
+	t.task.run = rb_set_run;
+	atomic_init(&t.task.done, 0);
+	t.op = op;
+	t.a = a->root;
+	t.b = b->root;
+	t.abh = rb_black_height(a, a->root);
+	t.bbh = rb_black_height(b, b->root);
+	pthread_mutex_lock(&rb_pool_user);
+	rb_pool_start();
+	rb_set_run(&t.task);
+	pthread_mutex_unlock(&rb_pool_user);
+	a->root = t.root;
+	if (a->root != a->nil) {
+		a->root->parent = a->nil;
+		a->root->color = 'b';
+	}
+	rb_take_slabs(a, b, arena);
+	for (n = t.dropped; n != NULL; n = next) {
+		next = n->parent;
+		rb_free_subtree(a, n);
+	}
+	RBfree(b);
+	return a;
+}
+/* Runs a set operation task. */
+/* For union and intersection, b is split at a's root; for difference, a is
+ * split at b's root. The subtrees and nodes that don't make it into the
+ * result are listed in t->dropped for rb_set_op to free: tasks run on
+ * several threads at once, so they can't use the result's free list. */
+static void rb_set_run(struct rb_task *task) {
+	struct rb_set_task *t = (struct rb_set_task *)task;
+	struct rb_set_task left, right;
+	/* Somewhere for the joins to keep a root and count rotations. It has
+	 * no slabs, and the joins never allocate. */
+	struct rb_tree scratch;
+	rb_node pivot, match;
+	rb_init_tree(&scratch);
+	t->dropped = t->dropped_last = NULL;
+	if (t->a == &rb_nil || t->b == &rb_nil) {
+		if (t->op == RB_UNION && t->a == &rb_nil) {
+			t->root = t->b;
+			t->bh = t->bbh;
+		} else if (t->op == RB_INTERSECT) {
+			rb_set_drop(t, t->a);
+			rb_set_drop(t, t->b);
+			t->root = &rb_nil;
+			t->bh = 0;
+		} else {
+			if (t->op == RB_DIFFERENCE) rb_set_drop(t, t->b);
+			t->root = t->a;
+			t->bh = t->abh;
+		}
+		return;
+	}
+	left.op = right.op = t->op;
+	left.task.run = right.task.run = rb_set_run;
+	atomic_init(&left.task.done, 0);
+	atomic_init(&right.task.done, 0);
+	if (t->op == RB_DIFFERENCE) {
+		pivot = t->b;
+		rb_split_subtree(&scratch, t->a, t->abh, pivot->key,
+			&left.a, &left.abh, &match, &right.a, &right.abh);
+		left.b = pivot->lchild;
+		right.b = pivot->rchild;
+		left.bbh = right.bbh = t->bbh - (pivot->color == 'b');
+	} else {
+		pivot = t->a;
+		rb_split_subtree(&scratch, t->b, t->bbh, pivot->key,
+			&left.b, &left.bbh, &match, &right.b, &right.bbh);
+		left.a = pivot->lchild;
+		right.a = pivot->rchild;
+		left.abh = right.abh = t->abh - (pivot->color == 'b');
+	}
+	if (t->abh >= RB_SET_GRAIN && t->bbh >= RB_SET_GRAIN) {
+		rb_fork(&left.task);
+		rb_set_run(&right.task);
+		rb_sync(&left.task);
+	} else {
+		rb_set_run(&left.task);
+		rb_set_run(&right.task);
+	}
+	if (t->op == RB_UNION || (t->op == RB_INTERSECT && match != &rb_nil)) {
+		t->root = rb_join_subtrees(&scratch, left.root, left.bh, pivot,
+			right.root, right.bh, &t->bh);
+	} else {
+		t->root = rb_join2_subtrees(&scratch, left.root, left.bh,
+			right.root, right.bh, &t->bh);
+		/* The pivot's children went to left and right */
+		pivot->lchild = pivot->rchild = &rb_nil;
+		rb_set_drop(t, pivot);
+	}
+	/* The split left match alone, with stale links; the result has a
+	 * node of its own with that key, except in a difference */
+	if (match != &rb_nil) {
+		match->lchild = match->rchild = &rb_nil;
+		rb_set_drop(t, match);
+	}
+	rb_set_gather(t, &left);
+	rb_set_gather(t, &right);
+}
+/* Helper routine: lists the subtree at n as dropped from a task's result. */
+static void rb_set_drop(struct rb_set_task *t, rb_node n) {
+	if (n == &rb_nil) return;
+	n->parent = t->dropped;
+	t->dropped = n;
+	if (t->dropped_last == NULL) t->dropped_last = n;
+}
+/* Helper routine: adds the subtrees a subtask dropped to a task's list. */
+static void rb_set_gather(struct rb_set_task *t, struct rb_set_task *sub) {
+	if (sub->dropped == NULL) return;
+	sub->dropped_last->parent = t->dropped;
+	t->dropped = sub->dropped;
+	if (t->dropped_last == NULL) t->dropped_last = sub->dropped_last;
+}
+/* Starts the pool's threads. */
+/* One per CPU, the caller being the first. They are started by the first set
+ * operation and stay until RBcleanup(). */
+static void rb_pool_start() {
+	long ncpu;
+	int i;
+	if (rb_pool_size != 0) return;
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu > RB_POOL_MAX) ncpu = RB_POOL_MAX;
+	pthread_mutex_lock(&rb_pool_lock);
+	rb_pool_stop = 0;
+	for (i = 1; i < ncpu; i++) {
+		if (pthread_create(&rb_pool_threads[i], NULL, rb_pool_worker,
+				(void *)(intptr_t)i) != 0) {
+			/* Make do with the threads we have */
+			break;
+		}
+	}
+	rb_pool_size = i;
+	pthread_mutex_unlock(&rb_pool_lock);
+}
+/* Body of a pool thread. */
+static void *rb_pool_worker(void *self) {
+	rb_pool_self = (int)(intptr_t)self;
+	pthread_mutex_lock(&rb_pool_lock);
+	while (!rb_pool_stop) {
+		struct rb_task *t = rb_pool_take();
+		if (t == NULL) {
+			pthread_cond_wait(&rb_pool_wake, &rb_pool_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&rb_pool_lock);
+		t->run(t);
+		atomic_store_explicit(&t->done, 1, memory_order_release);
+		pthread_mutex_lock(&rb_pool_lock);
+	}
+	pthread_mutex_unlock(&rb_pool_lock);
+	return NULL;
+}
+/* Takes a task from a queue. */
+static struct rb_task *rb_pool_take() {
+	struct rb_deque *d = &rb_deques[rb_pool_self];
+	struct rb_task *ret = NULL;
+	int i;
+	if (d->bottom > d->top) {
+		ret = d->tasks[--d->bottom];
+	}
+	for (i = 1; ret == NULL && i < rb_pool_size; i++) {
+		d = &rb_deques[(rb_pool_self + i) % rb_pool_size];
+		if (d->bottom > d->top) {
+			ret = d->tasks[d->top++];
+		}
+	}
+	if (ret != NULL && d->top == d->bottom) {
+		d->top = d->bottom = 0;
+	}
+	return ret;
+}
+/* Queues a task for any thread to run. */
+static void rb_fork(struct rb_task *task) {
+	struct rb_deque *d = &rb_deques[rb_pool_self];
+	if (rb_pool_size > 1) {
+		pthread_mutex_lock(&rb_pool_lock);
+		if (d->bottom < RB_DEQUE_MAX) {
+			d->tasks[d->bottom++] = task;
+			pthread_cond_signal(&rb_pool_wake);
+			pthread_mutex_unlock(&rb_pool_lock);
+			return;
+		}
+		pthread_mutex_unlock(&rb_pool_lock);
+	}
+	task->run(task);
+	atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+/* Waits for a forked task to finish. */
+/* Usually nobody has stolen it and we take it straight back. If it has been
+ * stolen, we help with whatever else is queued until it is done. */
+static void rb_sync(struct rb_task *task) {
+	while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+		struct rb_task *t;
+		pthread_mutex_lock(&rb_pool_lock);
+		t = rb_pool_take();
+		pthread_mutex_unlock(&rb_pool_lock);
+		if (t != NULL) {
+			t->run(t);
+			atomic_store_explicit(&t->done, 1, memory_order_release);
+		} else {
+			sched_yield();
+		}
+	}
+}
+/* Stops the pool's threads. */
+static void rb_pool_stop_all() {
+	int i;
+	if (rb_pool_size == 0) return;
+	pthread_mutex_lock(&rb_pool_lock);
+	rb_pool_stop = 1;
+	pthread_cond_broadcast(&rb_pool_wake);
+	pthread_mutex_unlock(&rb_pool_lock);
+	for (i = 1; i < rb_pool_size; i++) {
+		pthread_join(rb_pool_threads[i], NULL);
+	}
+	rb_pool_size = 0;
+}
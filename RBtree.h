@@ -1,13 +1,36 @@
 #ifndef RBTREE_H
 #define RBTREE_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 typedef struct rb_tree *rb_tree;
 
+/* A position in a tree, used to walk its keys in order. Seek it with one of
+ * RBfirst, RBlast, RBlower_bound, RBupper_bound, RBfloor or RBceiling. A
+ * cursor stays usable until the tree is next modified. */
+typedef struct rb_cursor {
+	rb_tree tree;
+	struct rb_node *node;
+} rb_cursor;
+
 /* Creates an empty Red-Black tree. */
 rb_tree RBcreate();
+/* Builds a tree from n keys in strictly increasing order in O(n). All nodes
+ * are allocated in one block. Returns NULL if the keys are not sorted or
+ * contain duplicates. */
+rb_tree RBbuild_sorted(const int *keys, size_t n);
+/* Makes a copy of a tree in O(n), with the same shape and colors, in one pass
+ * over the tree. The nodes are allocated in key order from the copy's slabs,
+ * so walking the copy in order (with cursors or RBrange) reads memory from
+ * one end of each slab to the other. The tree itself is not changed. Returns
+ * NULL if out of memory. */
+rb_tree RBclone(rb_tree tree);
 /* Frees an entire tree. */
 void RBfree(rb_tree tree);
-/* Cleans up. Call this when you won't be using any more Red-Black trees. */
+/* Cleans up. Call this when you won't be using any more Red-Black trees.
+ * Separate trees may be used from separate threads at the same time, but no
+ * other thread may be using the library while this runs. */
 void RBcleanup();
 
 /* Inserts an element with specified key into tree. */
@@ -15,17 +38,221 @@ int RBinsert(rb_tree tree, int key);
 
 /* Deletes an element with a particular key. */
 int RBdelete(rb_tree tree, int key);
+/* Deletes every element with a key in [lo, hi] and returns how many there
+ * were. The range is cut out in O(log n), and the k nodes in it are then
+ * given back to the tree's arena in one pass, for O(log n + k) in all. */
+size_t RBdelete_range(rb_tree tree, int lo, int hi);
+
+/* Splits tree into *lo, holding the keys below key, and *hi, holding the
+ * rest. tree is used up (it becomes one of the two). O(log n): nodes are
+ * relinked, not copied. The two trees may then be used and freed separately,
+ * from different threads, though their memory is only released once both
+ * have been freed. Returns 0 if out of memory, leaving tree as it was. */
+int RBsplit(rb_tree tree, int key, rb_tree *lo, rb_tree *hi);
+/* Joins lo, a new element pivot and hi into one tree, which is returned; lo
+ * and hi are used up. Every key in lo must be below pivot and every key in hi
+ * above it. O(log n). Returns NULL, leaving both trees as they were, if the
+ * keys are out of order or memory runs out. */
+rb_tree RBjoin(rb_tree lo, int pivot, rb_tree hi);
+
+/* Set operations. Each uses up both trees and returns the result (or NULL,
+ * leaving the trees as they were, if out of memory). Nodes are relinked, not
+ * copied, and big trees are worked on by one thread per CPU, so for trees of
+ * m <= n keys they take O(m log(n/m + 1)) work spread over the CPUs. Nodes
+ * left out of the result are kept for its later inserts, which costs a visit
+ * to each of them. As with RBsplit, memory is released when the result is
+ * freed. */
+/* Keys in either tree. */
+rb_tree RBunion(rb_tree a, rb_tree b);
+/* Keys in both trees. */
+rb_tree RBintersect(rb_tree a, rb_tree b);
+/* Keys in a but not b. */
+rb_tree RBdifference(rb_tree a, rb_tree b);
+
+/* Returns nonzero if an element with the given key is in the tree. */
+int RBsearch(rb_tree tree, int key);
+/* Looks up n keys at once, storing 1 (found) or 0 (not found) in out[i] for
+ * each keys[i]. out may be NULL if only the count is wanted. Several descents
+ * are interleaved so that their cache misses overlap. Returns the number of
+ * keys found. */
+size_t RBsearch_many(rb_tree tree, const int *keys, size_t n, int *out);
+
+/* Cursor seeks. Each positions cur and returns nonzero if there is such an
+ * element, or returns 0 and leaves cur past the end otherwise. */
+/* Smallest element. */
+int RBfirst(rb_tree tree, rb_cursor *cur);
+/* Largest element. */
+int RBlast(rb_tree tree, rb_cursor *cur);
+/* Smallest element with key >= key. */
+int RBlower_bound(rb_tree tree, int key, rb_cursor *cur);
+/* Smallest element with key > key. */
+int RBupper_bound(rb_tree tree, int key, rb_cursor *cur);
+/* Largest element with key <= key. */
+int RBfloor(rb_tree tree, int key, rb_cursor *cur);
+/* Smallest element with key >= key (the same as RBlower_bound). */
+int RBceiling(rb_tree tree, int key, rb_cursor *cur);
+/* Moves to the next or previous element, returning 0 if we walked off the end.
+ * Amortized O(1). */
+int RBnext(rb_cursor *cur);
+int RBprev(rb_cursor *cur);
+/* Returns nonzero if the cursor is positioned on an element. */
+int RBcursor_valid(const rb_cursor *cur);
+/* Returns the key of the element under a valid cursor. */
+int RBcursor_key(const rb_cursor *cur);
+
+/* Calls fn(key, arg) for every key in [lo, hi], in increasing order. Returns
+ * the number of keys visited. O(log n + k) for k keys. */
+size_t RBrange(rb_tree tree, int lo, int hi, void (*fn)(int key, void *arg),
+		void *arg);
+/* Copies up to max keys in [lo, hi] into out, in increasing order. Returns the
+ * number of keys copied. */
+size_t RBrange_keys(rb_tree tree, int lo, int hi, int *out, size_t max);
+
+/* Lock-free versions of RBsearch and RBrange_keys. These may run in any
+ * number of threads while one other thread calls RBinsert or RBdelete on the
+ * same tree; they retry if the tree changes under them. The tree must not be
+ * freed while they run. */
+int RBsearch_concurrent(rb_tree tree, int key);
+size_t RBrange_concurrent(rb_tree tree, int lo, int hi, int *out, size_t max);
 
 /* Writes a tree to stdout in preorder format.
  * Outputs everything on the same line. */
 void RBwrite(rb_tree tree);
+/* Writes a tree to fp in the same format as RBwrite. Returns nonzero on
+ * success. For a file descriptor, use fdopen. */
+int RBwrite_to(rb_tree tree, FILE *fp);
+/* Writes the keys of a tree to fp in increasing order, one per line. Returns
+ * nonzero on success. */
+int RBwrite_sorted_to(rb_tree tree, FILE *fp);
 /* Reads a tree in preorder format from file.
- * Warning: does NOT check to see if the resulting tree violates Red-Black
- * properties, and BOLDLY ASSUMES that the input file is well-formatted. Will
- * return once it sees something it doesn't understand. */
+ * Malformed input, or a key that doesn't fit in an int, is reported with its
+ * line and column, and NULL is returned; so are keys that can't be the
+ * preorder of a search tree. If the keys are fine but the colors or shape
+ * break the Red-Black rules, the tree is rebuilt balanced in O(n). */
 rb_tree RBread(char *fname);
+/* Like RBread, but maps the file into memory instead of reading it. */
+rb_tree RBread_mmap(char *fname);
+/* Writes a tree to file descriptor fd in a compact binary format: a versioned
+ * header, a fixed-width record per node in preorder, and a checksum. Unlike
+ * RBwrite, an empty tree can be written. Returns nonzero on success. */
+int RBwrite_binary(rb_tree tree, int fd);
+/* Reads a tree written by RBwrite_binary from file descriptor fd. Returns NULL
+ * if the data is truncated, fails its checksum, or has an unknown version.
+ * Only the tree's own bytes are read, so several trees written one after
+ * another to a file, pipe or socket can be read back in turn. (Files from
+ * before version 2 of the format are still read, but may be read past.) */
+rb_tree RBread_binary(int fd);
+/* Writes a tree to file fname as an image that RBopen_mapped can use in place.
+ * Returns nonzero on success. */
+int RBwrite_image(rb_tree tree, char *fname);
+
+/* Checks every Red-Black property of a tree, and that its keys are in order
+ * and its parent links consistent. Returns nonzero if the tree is valid;
+ * otherwise reports the first problem found and returns 0. */
+int RBverify(rb_tree tree);
+
+/* Statistics filled in by RBstats. The counts run from when the tree was
+ * created; dividing, say, rotations by inserts + deletes gives the average
+ * rebalancing cost of an update. */
+struct rb_stats {
+	/* The tree as it is now */
+	size_t nodes;
+	int height;       /* nodes on the longest path from the root */
+	int black_height; /* black nodes on every path from the root */
+	/* Updates, and the work they did to keep the tree balanced */
+	size_t inserts, deletes;
+	size_t rotations;
+	size_t insert_case[3]; /* fixup cases 1-3 of an insertion */
+	size_t delete_case[4]; /* fixup cases 1-4 of a deletion */
+	/* Where new nodes came from: deleted nodes the tree's arena reused, and
+	 * unused ones it took from its slabs; and the slabs that arena grew by,
+	 * reused from a freed tree or malloc'd */
+	size_t pool_hits, pool_fresh;
+	size_t slab_reuses, slab_mallocs;
+	/* Calls to RBsearch and the nodes they stepped past, from every
+	 * thread. These are read without stopping searches, so calls still
+	 * in progress may or may not be counted. */
+	size_t searches, search_steps;
+};
+/* Fills in *out for a tree. Takes O(n) time for the node count and height;
+ * the counters themselves cost almost nothing to keep. Building with
+ * -DRB_NO_STATS leaves them out, and they all read 0. */
+void RBstats(rb_tree tree, struct rb_stats *out);
 
 /* Draws an SVG picture of the tree in the specified file. */
 void RBdraw(rb_tree tree, char *fname);
 
+/* A bucketed tree keeps its keys in sorted blocks of 32 and balances only the
+ * blocks, so it is far shallower than a tree of single keys and uses about a
+ * quarter of the memory. */
+typedef struct rb_btree *rb_btree;
+/* Creates an empty bucketed tree. */
+rb_btree RBbucket_create();
+/* Frees an entire bucketed tree. */
+void RBbucket_free(rb_btree bt);
+/* Inserts an element with specified key. */
+int RBbucket_insert(rb_btree bt, int key);
+/* Deletes an element with a particular key. */
+int RBbucket_delete(rb_btree bt, int key);
+/* Returns nonzero if an element with the given key is present. */
+int RBbucket_search(rb_btree bt, int key);
+/* Returns the number of elements. */
+size_t RBbucket_size(rb_btree bt);
+/* Returns the number of bytes the tree is using. */
+size_t RBbucket_memory(rb_btree bt);
+
+/* A mapped tree is an image written by RBwrite_image, mapped read-only
+ * straight from the file. Opening one takes constant time and allocates no
+ * nodes; pages are read in as searches touch them, and every process mapping
+ * the same file shares them. */
+typedef struct rb_mapped *rb_mapped;
+/* Maps the image in file fname. Returns NULL if it can't be mapped or isn't
+ * an image written on a host of the same byte order. */
+rb_mapped RBopen_mapped(char *fname);
+/* Unmaps an image. */
+void RBclose_mapped(rb_mapped m);
+/* Returns nonzero if an element with the given key is present. */
+int RBmapped_search(rb_mapped m, int key);
+/* Returns the number of elements. */
+size_t RBmapped_size(rb_mapped m);
+
+/* Tracing. Build with -DRB_TRACE=level to have the library report what it
+ * does: level 1 reports inserts and deletes, 2 also the fixup cases and
+ * rotations, and 3 also every node allocated or freed. Without RB_TRACE the
+ * calls below still exist but no events are ever produced, and the library
+ * is exactly as fast as if they didn't. */
+enum rb_trace_op {
+	RB_TRACE_INSERT,      /* a node was linked in */
+	RB_TRACE_DELETE,      /* a node was unlinked */
+	RB_TRACE_INSERT_CASE, /* arg is the insert fixup case, 1-3 */
+	RB_TRACE_DELETE_CASE, /* arg is the delete fixup case, 1-4 */
+	RB_TRACE_ROTATE,      /* arg is 1 for a left rotation, 0 for right */
+	RB_TRACE_ALLOC,       /* a node was taken from the arena */
+	RB_TRACE_FREE         /* a node was given back to the arena */
+};
+struct rb_trace_event {
+	unsigned long long seq; /* recorded events are numbered from 1; others are 0 */
+	rb_tree tree;
+	int op;  /* an enum rb_trace_op */
+	int arg;
+	int key; /* key of the node the event is about */
+};
+/* Calls fn(event, arg) for every event as it happens, in the thread doing the
+ * operation, or stops calling it if fn is NULL. Set this while no trees are
+ * in use. */
+void RBtrace_hook(void (*fn)(const struct rb_trace_event *e, void *arg),
+		void *arg);
+/* Starts (on nonzero) or stops recording events in a ring of the last few
+ * thousand. Recording takes no locks and may be left on. */
+void RBtrace_record(int on);
+/* Copies up to max recorded events, those numbered after *next, into out,
+ * and sets *next to the number of the last one copied. Start with *next at
+ * 0. Events overwritten before they could be read are skipped, which
+ * shows as a jump in seq. Returns the number of events copied. */
+size_t RBtrace_read(struct rb_trace_event *out, size_t max,
+		unsigned long long *next);
+/* Writes an event to fp (a FILE *) on one line. Can be passed to
+ * RBtrace_hook as is. */
+void RBtrace_print(const struct rb_trace_event *e, void *fp);
+
 #endif /* RBTREE_H */
@@ -0,0 +1,832 @@
+#ifndef RBTREE_HPP
+#define RBTREE_HPP
+
+/* rb::tree is the Red-Black tree of RBtree.c for any key and value type, as a
+ * header-only C++ template. The balancing code is RBtree.c's, line for line;
+ * what differs is that each node holds its key and value inline, keys are
+ * compared with an inlined Compare instead of <, and nodes come from an Alloc.
+ * The interface follows std::map, so it can stand in for one. */
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace rb {
+
+template <class Key, class Value, class Compare, class Alloc> class tree;
+
+namespace detail {
+
+/* The part of a node the balancing code works with. */
+struct node_base {
+	node_base *parent;
+	node_base *lchild,
+		  *rchild;
+	char color;
+};
+
+/* A node with its element. The element is constructed and destroyed through
+ * the tree's allocator, separately from the links. */
+template <class T>
+struct node : node_base {
+	alignas(T) unsigned char storage[sizeof(T)];
+	T *value() { return reinterpret_cast<T *>(storage); }
+};
+
+/* The nil sentinel shared by every tree, as in RBtree.c. Nothing ever writes
+ * to it. (A template so the header can define it.) */
+template <class Unused = void>
+struct nil_holder {
+	static node_base nil;
+};
+template <class Unused>
+node_base nil_holder<Unused>::nil = {
+	&nil_holder<Unused>::nil, &nil_holder<Unused>::nil,
+	&nil_holder<Unused>::nil, 'b'
+};
+
+/* Everything that doesn't depend on the key or value type: the root, the size
+ * and the Red-Black machinery, so it is only compiled once however many kinds
+ * of tree a program uses. */
+class tree_base {
+public:
+	node_base *root;
+	std::size_t nnodes;
+
+	tree_base() : root(nil()), nnodes(0) {}
+
+	static node_base *nil() { return &nil_holder<>::nil; }
+
+	/* Returns minimum node in the given subtree. */
+	static node_base *min(node_base *node) {
+		while (node->lchild != nil())
+			node = node->lchild;
+		return node;
+	}
+	/* Returns maximum node in the given subtree. */
+	static node_base *max(node_base *node) {
+		while (node->rchild != nil())
+			node = node->rchild;
+		return node;
+	}
+	/* Returns the in-order successor of a node, or nil if it has none. */
+	static node_base *successor(node_base *node) {
+		node_base *up;
+		if (node->rchild != nil()) {
+			return min(node->rchild);
+		}
+		/* Climb until we come up out of a left subtree */
+		up = node->parent;
+		while (up != nil() && node == up->rchild) {
+			node = up;
+			up = up->parent;
+		}
+		return up;
+	}
+	/* Returns the in-order predecessor of a node, or nil if it has none. */
+	static node_base *predecessor(node_base *node) {
+		node_base *up;
+		if (node->lchild != nil()) {
+			return max(node->lchild);
+		}
+		/* Climb until we come up out of a right subtree */
+		up = node->parent;
+		while (up != nil() && node == up->lchild) {
+			node = up;
+			up = up->parent;
+		}
+		return up;
+	}
+
+	/* Links a new node in as the left or right child of parent (or as the
+	 * root, if parent is nil) and restores the Red-Black properties. */
+	void link(node_base *newnode, node_base *newparent, bool left) {
+		newnode->parent = newparent;
+		newnode->lchild = nil();
+		newnode->rchild = nil();
+		newnode->color = 'r';
+		if (newparent == nil()) {
+			root = newnode;
+		} else if (left) {
+			newparent->lchild = newnode;
+		} else {
+			newparent->rchild = newnode;
+		}
+		nnodes++;
+		/* Fix the tree structure */
+		insert_fix(newnode);
+	}
+	/* Corrects for properties violated on an insertion. */
+	void insert_fix(node_base *n) {
+		node_base *gp = n->parent->parent, /* grandparent */
+			  *uncle = get_uncle(n);
+		/* Case 1: uncle is colored red */
+		while (n->parent->color == 'r' && uncle->color == 'r') {
+			gp->color = 'r';
+			uncle->color = 'b';
+			n->parent->color = 'b';
+			n = gp;
+			gp = n->parent->parent;
+			uncle = get_uncle(n);
+		}
+
+		if (n->parent->color == 'b') {
+			if (n == root) n->color = 'b';
+			return;
+		}
+
+		/* Case 2: node is "close to" uncle */
+		if ((n->parent->lchild == n) == (gp->lchild == uncle)) {
+			node_base *new_n = n->parent;
+			rotate(new_n, new_n->rchild == n);
+			n = new_n;
+		} /* Fall through */
+		/* Case 3: node is "far from" uncle */
+		n->parent->color = 'b';
+		gp->color = 'r';
+		rotate(gp, gp->lchild == uncle);
+		root->color = 'b';
+	}
+	/* Helper routine: returns the uncle of a given node. */
+	node_base *get_uncle(node_base *n) {
+		node_base *gp;
+		if (n->parent == nil() || n->parent->parent == nil()) {
+			return nil();
+		}
+		gp = n->parent->parent;
+		return (gp->lchild == n->parent) ? gp->rchild : gp->lchild;
+	}
+
+	/* Takes a node out of the tree and restores the Red-Black properties.
+	 * The node itself is left for the caller to free. */
+	void unlink(node_base *dead) {
+		/* The node where we will fix the tree structure */
+		node_base *fixit;
+		/* fixit's parent, which we keep track of ourselves since fixit
+		 * may be nil */
+		node_base *fixparent;
+		/* Original color of the deleted node */
+		char orig_col = dead->color;
+		/* Here we perform binary tree deletion */
+		if (dead->lchild == nil()) {
+			fixit = dead->rchild;
+			fixparent = dead->parent;
+			transplant(dead, fixit);
+		} else if (dead->rchild == nil()) {
+			fixit = dead->lchild;
+			fixparent = dead->parent;
+			transplant(dead, fixit);
+		} else {
+			/* Replace dead with its successor */
+			node_base *successor = min(dead->rchild);
+			orig_col = successor->color;
+			fixit = successor->rchild;
+			if (successor->parent == dead) {
+				fixparent = successor;
+			} else {
+				/* Put the successor's right child into its place */
+				fixparent = successor->parent;
+				transplant(successor, successor->rchild);
+				successor->rchild = dead->rchild;
+				successor->rchild->parent = successor;
+			}
+			transplant(dead, successor);
+			successor->lchild = dead->lchild;
+			successor->lchild->parent = successor;
+			successor->color = dead->color;
+		}
+		nnodes--;
+		/* Only need to fix if we deleted a black node */
+		if (orig_col == 'b') {
+			delete_fix(fixit, fixparent);
+		}
+	}
+	/* Helper routine: transplants node `from' into node `to's position. */
+	void transplant(node_base *to, node_base *from) {
+		if (to->parent == nil()) {
+			root = from;
+		} else if (to == to->parent->lchild) {
+			to->parent->lchild = from;
+		} else {
+			to->parent->rchild = from;
+		}
+		if (from != nil()) {
+			from->parent = to->parent;
+		}
+	}
+	/* Corrects for properties violated on a deletion. n may be nil, so
+	 * its parent is passed in separately. */
+	void delete_fix(node_base *n, node_base *parent) {
+		/* It's always safe to change the root black, and if we reach a
+		 * red node, we can fix the tree by changing it black. */
+		while (n != root && n->color == 'b') {
+			/* Instead of duplicating code, we just have a flag to
+			 * test which direction we are dealing with. */
+			bool is_left = (n == parent->lchild);
+			node_base *sibling = (is_left) ? parent->rchild : parent->lchild;
+			/* Case 1: sibling red */
+			if (sibling->color == 'r') {
+				sibling->color = 'b';
+				parent->color = 'r';
+				rotate(parent, is_left);
+				sibling = (is_left) ? parent->rchild : parent->lchild;
+			}
+			/* Case 2: sibling black, both sibling's children black */
+			if (sibling->lchild->color == 'b' && sibling->rchild->color == 'b') {
+				sibling->color = 'r';
+				n = parent;
+				parent = n->parent;
+			} else {
+				/* Case 3: sibling black, "far" child black */
+				if (( is_left && sibling->rchild->color == 'b') ||
+				    (!is_left && sibling->lchild->color == 'b')) {
+					if (is_left) {
+						sibling->lchild->color = 'b';
+					} else {
+						sibling->rchild->color = 'b';
+					}
+					sibling->color = 'r';
+					rotate(sibling, !is_left);
+					sibling = (is_left) ? parent->rchild : parent->lchild;
+				} /* Fall through */
+				/* Case 4: sibling black, "far" child red */
+				sibling->color = parent->color;
+				parent->color = 'b';
+				if (is_left) {
+					sibling->rchild->color = 'b';
+				} else {
+					sibling->lchild->color = 'b';
+				}
+				rotate(parent, is_left);
+				/* We're done, so set n to the root node */
+				n = root;
+			}
+		}
+		if (n != nil()) {
+			n->color = 'b';
+		}
+	}
+	/* Rotates a tree around the given root. */
+	void rotate(node_base *top, bool go_left) {
+		/* The new top node */
+		node_base *newroot = (go_left) ? top->rchild : top->lchild;
+		/* We swap the center child and the old top node */
+		if (go_left) {
+			top->rchild = newroot->lchild;
+			if (top->rchild != nil()) {
+				top->rchild->parent = top;
+			}
+			newroot->lchild = top;
+		} else {
+			top->lchild = newroot->rchild;
+			if (top->lchild != nil()) {
+				top->lchild->parent = top;
+			}
+			newroot->rchild = top;
+		}
+		/* Now we set up the parent nodes */
+		newroot->parent = top->parent;
+		top->parent = newroot;
+		/* We update old top node's parent to point to the new top node */
+		if (newroot->parent == nil()) {
+			root = newroot;
+		} else if (newroot->parent->lchild == top) {
+			newroot->parent->lchild = newroot;
+		} else {
+			newroot->parent->rchild = newroot;
+		}
+	}
+};
+
+/* A bidirectional iterator over a tree's elements, in key order. Like an
+ * rb_cursor it knows its tree, so that end() can be stepped back from. */
+template <class T, bool Const>
+class tree_iterator {
+	typedef node<T> node_type;
+	friend class tree_iterator<T, !Const>;
+	template <class K, class V, class C, class A> friend class rb::tree;
+
+	node_base *cur;
+	const tree_base *owner;
+
+	tree_iterator(node_base *n, const tree_base *t) : cur(n), owner(t) {}
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef typename std::conditional<Const, const T *, T *>::type pointer;
+	typedef typename std::conditional<Const, const T &, T &>::type reference;
+
+	tree_iterator() : cur(0), owner(0) {}
+	/* An iterator converts to a const_iterator */
+	template <bool C, class = typename std::enable_if<Const && !C>::type>
+	tree_iterator(const tree_iterator<T, C> &it) : cur(it.cur), owner(it.owner) {}
+
+	reference operator*() const { return *static_cast<node_type *>(cur)->value(); }
+	pointer operator->() const { return static_cast<node_type *>(cur)->value(); }
+
+	tree_iterator &operator++() {
+		cur = tree_base::successor(cur);
+		return *this;
+	}
+	tree_iterator operator++(int) {
+		tree_iterator ret = *this;
+		++*this;
+		return ret;
+	}
+	/* Stepping back from end() gives the largest element */
+	tree_iterator &operator--() {
+		if (cur == tree_base::nil()) {
+			cur = tree_base::max(owner->root);
+		} else {
+			cur = tree_base::predecessor(cur);
+		}
+		return *this;
+	}
+	tree_iterator operator--(int) {
+		tree_iterator ret = *this;
+		--*this;
+		return ret;
+	}
+
+	friend bool operator==(const tree_iterator &a, const tree_iterator &b) {
+		return a.cur == b.cur;
+	}
+	friend bool operator!=(const tree_iterator &a, const tree_iterator &b) {
+		return a.cur != b.cur;
+	}
+};
+
+} /* namespace detail */
+
+/* An ordered map from Key to Value. Keys are unique. Iterators and references
+ * stay valid until their element is erased; end() is the only iterator tied
+ * to a particular tree object, so it doesn't follow a tree that is moved or
+ * swapped. */
+template <class Key, class Value, class Compare = std::less<Key>,
+	class Alloc = std::allocator<std::pair<const Key, Value> > >
+class tree : private detail::tree_base {
+public:
+	typedef Key key_type;
+	typedef Value mapped_type;
+	typedef std::pair<const Key, Value> value_type;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef Compare key_compare;
+	typedef Alloc allocator_type;
+	typedef value_type &reference;
+	typedef const value_type &const_reference;
+	typedef typename std::allocator_traits<Alloc>::pointer pointer;
+	typedef typename std::allocator_traits<Alloc>::const_pointer const_pointer;
+	typedef detail::tree_iterator<value_type, false> iterator;
+	typedef detail::tree_iterator<value_type, true> const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+private:
+	typedef detail::node_base node_base;
+	typedef detail::node<value_type> node_type;
+	typedef typename std::allocator_traits<Alloc>::template
+		rebind_alloc<node_type> node_alloc;
+	typedef std::allocator_traits<node_alloc> node_traits;
+
+	Compare comp;
+	node_alloc alloc;
+
+public:
+	/* Creates an empty tree. */
+	tree() : comp(), alloc() {}
+	explicit tree(const Compare &c, const Alloc &a = Alloc())
+		: comp(c), alloc(a) {}
+	explicit tree(const Alloc &a) : comp(), alloc(a) {}
+	tree(std::initializer_list<value_type> init,
+			const Compare &c = Compare(), const Alloc &a = Alloc())
+		: comp(c), alloc(a) {
+		insert(init.begin(), init.end());
+	}
+	template <class InputIt>
+	tree(InputIt first, InputIt last, const Compare &c = Compare(),
+			const Alloc &a = Alloc())
+		: comp(c), alloc(a) {
+		insert(first, last);
+	}
+	/* Copies keep the shape and colors of the original, so no fixups. */
+	tree(const tree &other)
+		: comp(other.comp),
+		  alloc(node_traits::select_on_container_copy_construction(other.alloc)) {
+		copy_from(other);
+	}
+	tree(tree &&other) noexcept
+		: comp(std::move(other.comp)), alloc(std::move(other.alloc)) {
+		steal(other);
+	}
+	~tree() {
+		clear();
+	}
+
+	tree &operator=(const tree &other) {
+		if (this != &other) {
+			clear();
+			comp = other.comp;
+			if (node_traits::propagate_on_container_copy_assignment::value) {
+				alloc = other.alloc;
+			}
+			copy_from(other);
+		}
+		return *this;
+	}
+	/* Nodes are taken over whole when the allocators allow it, and moved
+	 * one element at a time when they don't. */
+	tree &operator=(tree &&other) {
+		if (this != &other) {
+			clear();
+			comp = std::move(other.comp);
+			if (node_traits::propagate_on_container_move_assignment::value) {
+				alloc = std::move(other.alloc);
+				steal(other);
+			} else if (alloc == other.alloc) {
+				steal(other);
+			} else {
+				for (iterator it = other.begin(); it != other.end(); ++it) {
+					emplace_hint(end(), std::move(it->first),
+						std::move(it->second));
+				}
+				other.clear();
+			}
+		}
+		return *this;
+	}
+	tree &operator=(std::initializer_list<value_type> init) {
+		clear();
+		insert(init.begin(), init.end());
+		return *this;
+	}
+
+	allocator_type get_allocator() const { return allocator_type(alloc); }
+	key_compare key_comp() const { return comp; }
+
+	/* Iterators */
+	iterator begin() { return make_iter(min(root)); }
+	const_iterator begin() const { return make_citer(min(root)); }
+	const_iterator cbegin() const { return begin(); }
+	iterator end() { return make_iter(nil()); }
+	const_iterator end() const { return make_citer(nil()); }
+	const_iterator cend() const { return end(); }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator crbegin() const { return rbegin(); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+	const_reverse_iterator crend() const { return rend(); }
+
+	/* Size */
+	bool empty() const { return nnodes == 0; }
+	size_type size() const { return nnodes; }
+	size_type max_size() const { return node_traits::max_size(alloc); }
+
+	/* Frees every node. O(n), with no recursion. */
+	void clear() {
+		node_base *n = root;
+		while (n != nil()) {
+			if (n->lchild != nil()) {
+				n = n->lchild;
+			} else if (n->rchild != nil()) {
+				n = n->rchild;
+			} else {
+				/* A leaf: cut it off and go back up */
+				node_base *up = n->parent;
+				if (up != nil()) {
+					if (up->lchild == n) {
+						up->lchild = nil();
+					} else {
+						up->rchild = nil();
+					}
+				}
+				drop_node(static_cast<node_type *>(n));
+				n = up;
+			}
+		}
+		root = nil();
+		nnodes = 0;
+	}
+
+	/* Insertion. Each returns the element with the key and whether it was
+	 * added (false if the key was already there). */
+	std::pair<iterator, bool> insert(const value_type &v) {
+		return emplace_key(v.first, v);
+	}
+	std::pair<iterator, bool> insert(value_type &&v) {
+		return emplace_key(v.first, std::move(v));
+	}
+	template <class P, class = typename
+		std::enable_if<std::is_constructible<value_type, P &&>::value>::type>
+	std::pair<iterator, bool> insert(P &&v) {
+		return emplace(std::forward<P>(v));
+	}
+	template <class InputIt>
+	void insert(InputIt first, InputIt last) {
+		for (; first != last; ++first) {
+			emplace_hint(end(), *first);
+		}
+	}
+	void insert(std::initializer_list<value_type> init) {
+		insert(init.begin(), init.end());
+	}
+	/* Constructs the element in place. The key is only known once it is
+	 * built, so a node is made either way and thrown away on a duplicate. */
+	template <class... Args>
+	std::pair<iterator, bool> emplace(Args &&... args) {
+		node_type *n = make_node(std::forward<Args>(args)...);
+		node_base *parent;
+		bool left;
+		node_base *found = find_slot(n->value()->first, parent, left);
+		if (found != nil()) {
+			drop_node(n);
+			return std::make_pair(make_iter(found), false);
+		}
+		link(n, parent, left);
+		return std::make_pair(make_iter(n), true);
+	}
+	/* Like emplace; when hint is just after where the key belongs (as it is
+	 * with end() for keys in increasing order) there is no search. */
+	template <class... Args>
+	iterator emplace_hint(const_iterator hint, Args &&... args) {
+		node_type *n = make_node(std::forward<Args>(args)...);
+		const Key &k = n->value()->first;
+		node_base *parent;
+		bool left;
+		node_base *found;
+		node_base *after = hint.cur;
+		node_base *before = (after == nil()) ? max(root) : predecessor(after);
+		if ((after == nil() || comp(k, key_of(after))) &&
+		    (before == nil() || comp(key_of(before), k))) {
+			/* It goes between before and after, so one of them has a
+			 * free slot next to it */
+			if (before != nil() && before->rchild == nil()) {
+				link(n, before, false);
+			} else {
+				link(n, after, true);
+			}
+			return make_iter(n);
+		}
+		found = find_slot(k, parent, left);
+		if (found != nil()) {
+			drop_node(n);
+			return make_iter(found);
+		}
+		link(n, parent, left);
+		return make_iter(n);
+	}
+	/* Constructs the value from args only if the key isn't there yet. */
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(const Key &k, Args &&... args) {
+		return emplace_key(k, std::piecewise_construct,
+			std::forward_as_tuple(k),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(Key &&k, Args &&... args) {
+		return emplace_key(k, std::piecewise_construct,
+			std::forward_as_tuple(std::move(k)),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+	template <class M>
+	std::pair<iterator, bool> insert_or_assign(const Key &k, M &&obj) {
+		std::pair<iterator, bool> ret = try_emplace(k, std::forward<M>(obj));
+		if (!ret.second) ret.first->second = std::forward<M>(obj);
+		return ret;
+	}
+	template <class M>
+	std::pair<iterator, bool> insert_or_assign(Key &&k, M &&obj) {
+		std::pair<iterator, bool> ret =
+			try_emplace(std::move(k), std::forward<M>(obj));
+		if (!ret.second) ret.first->second = std::forward<M>(obj);
+		return ret;
+	}
+	/* Returns the value for a key, inserting a default one if need be. */
+	Value &operator[](const Key &k) {
+		return try_emplace(k).first->second;
+	}
+	Value &operator[](Key &&k) {
+		return try_emplace(std::move(k)).first->second;
+	}
+	/* Returns the value for a key, throwing std::out_of_range if the key
+	 * isn't there. */
+	Value &at(const Key &k) {
+		iterator it = find(k);
+		if (it == end()) throw std::out_of_range("rb::tree::at");
+		return it->second;
+	}
+	const Value &at(const Key &k) const {
+		const_iterator it = find(k);
+		if (it == end()) throw std::out_of_range("rb::tree::at");
+		return it->second;
+	}
+
+	/* Deletion. Erasing by iterator returns the element after it. */
+	iterator erase(const_iterator pos) {
+		node_base *dead = pos.cur;
+		node_base *next = successor(dead);
+		unlink(dead);
+		drop_node(static_cast<node_type *>(dead));
+		return make_iter(next);
+	}
+	iterator erase(iterator pos) {
+		return erase(const_iterator(pos));
+	}
+	iterator erase(const_iterator first, const_iterator last) {
+		while (first != last) {
+			first = erase(first);
+		}
+		return make_iter(last.cur);
+	}
+	/* Returns the number of elements erased, 0 or 1. */
+	size_type erase(const Key &k) {
+		node_base *dead = find_node(k);
+		if (dead == nil()) return 0;
+		unlink(dead);
+		drop_node(static_cast<node_type *>(dead));
+		return 1;
+	}
+
+	void swap(tree &other) {
+		using std::swap;
+		swap(comp, other.comp);
+		if (node_traits::propagate_on_container_swap::value) {
+			swap(alloc, other.alloc);
+		}
+		swap(root, other.root);
+		swap(nnodes, other.nnodes);
+	}
+	friend void swap(tree &a, tree &b) {
+		a.swap(b);
+	}
+
+	/* Searching */
+	iterator find(const Key &k) { return make_iter(find_node(k)); }
+	const_iterator find(const Key &k) const { return make_citer(find_node(k)); }
+	size_type count(const Key &k) const { return find_node(k) != nil(); }
+	bool contains(const Key &k) const { return find_node(k) != nil(); }
+	/* First element with key >= k */
+	iterator lower_bound(const Key &k) { return make_iter(lower_node(k)); }
+	const_iterator lower_bound(const Key &k) const { return make_citer(lower_node(k)); }
+	/* First element with key > k */
+	iterator upper_bound(const Key &k) { return make_iter(upper_node(k)); }
+	const_iterator upper_bound(const Key &k) const { return make_citer(upper_node(k)); }
+	std::pair<iterator, iterator> equal_range(const Key &k) {
+		return std::make_pair(lower_bound(k), upper_bound(k));
+	}
+	std::pair<const_iterator, const_iterator> equal_range(const Key &k) const {
+		return std::make_pair(lower_bound(k), upper_bound(k));
+	}
+
+private:
+	iterator make_iter(node_base *n) const {
+		return iterator(n, static_cast<const tree_base *>(this));
+	}
+	const_iterator make_citer(node_base *n) const {
+		return const_iterator(n, static_cast<const tree_base *>(this));
+	}
+	static const Key &key_of(node_base *n) {
+		return static_cast<node_type *>(n)->value()->first;
+	}
+
+	/* Allocates a node and constructs its element from args. */
+	template <class... Args>
+	node_type *make_node(Args &&... args) {
+		typename node_traits::pointer p = node_traits::allocate(alloc, 1);
+		node_type *n = ::new (static_cast<void *>(std::addressof(*p))) node_type;
+		try {
+			node_traits::construct(alloc, n->value(),
+				std::forward<Args>(args)...);
+		} catch (...) {
+			node_traits::deallocate(alloc, p, 1);
+			throw;
+		}
+		return n;
+	}
+	/* Destroys a node's element and frees the node. */
+	void drop_node(node_type *n) {
+		node_traits::destroy(alloc, n->value());
+		n->~node_type();
+		node_traits::deallocate(alloc,
+			std::pointer_traits<typename node_traits::pointer>::pointer_to(*n), 1);
+	}
+
+	/* Returns the node with key k, or nil. One comparison per level: we
+	 * look for the lower bound and check it at the end. */
+	node_base *find_node(const Key &k) const {
+		node_base *n = lower_node(k);
+		return (n != nil() && !comp(k, key_of(n))) ? n : nil();
+	}
+	/* Returns the first node with key >= k, or nil. */
+	node_base *lower_node(const Key &k) const {
+		node_base *pos = root, *ret = nil();
+		while (pos != nil()) {
+			if (!comp(key_of(pos), k)) {
+				ret = pos;
+				pos = pos->lchild;
+			} else {
+				pos = pos->rchild;
+			}
+		}
+		return ret;
+	}
+	/* Returns the first node with key > k, or nil. */
+	node_base *upper_node(const Key &k) const {
+		node_base *pos = root, *ret = nil();
+		while (pos != nil()) {
+			if (comp(k, key_of(pos))) {
+				ret = pos;
+				pos = pos->lchild;
+			} else {
+				pos = pos->rchild;
+			}
+		}
+		return ret;
+	}
+	/* Finds where a node with key k would go, setting parent and left for
+	 * link(). Returns the node already holding k, or nil if there is none. */
+	node_base *find_slot(const Key &k, node_base *&parent, bool &left) const {
+		node_base *pos = root;
+		node_base *below = nil(); /* last node we went right from */
+		parent = nil();
+		left = true;
+		while (pos != nil()) {
+			parent = pos;
+			left = comp(k, key_of(pos));
+			if (left) {
+				pos = pos->lchild;
+			} else {
+				below = pos;
+				pos = pos->rchild;
+			}
+		}
+		/* below is the largest key <= k, so it is k if anything is */
+		if (below != nil() && !comp(key_of(below), k)) {
+			return below;
+		}
+		return nil();
+	}
+	/* Inserts an element built from args if key k isn't already there. */
+	template <class... Args>
+	std::pair<iterator, bool> emplace_key(const Key &k, Args &&... args) {
+		node_base *parent;
+		bool left;
+		node_base *found = find_slot(k, parent, left);
+		if (found != nil()) {
+			return std::make_pair(make_iter(found), false);
+		}
+		node_type *n = make_node(std::forward<Args>(args)...);
+		link(n, parent, left);
+		return std::make_pair(make_iter(n), true);
+	}
+
+	/* Takes other's nodes, leaving it empty. */
+	void steal(tree &other) {
+		root = other.root;
+		nnodes = other.nnodes;
+		other.root = nil();
+		other.nnodes = 0;
+	}
+	/* Copies other's nodes into this (empty) tree, shape and colors
+	 * included. If an element's copy throws, what was copied is freed. */
+	void copy_from(const tree &other) {
+		try {
+			copy_subtree(other.root, nil(), root);
+		} catch (...) {
+			clear();
+			throw;
+		}
+		nnodes = other.nnodes;
+	}
+	/* Helper routine: copies the subtree at src below parent, storing it in
+	 * slot. Each node is linked in before its children are copied, so the
+	 * tree can be cleared at any point. The depth is O(log n). */
+	void copy_subtree(node_base *src, node_base *parent, node_base *&slot) {
+		node_type *n;
+		if (src == nil()) {
+			slot = nil();
+			return;
+		}
+		n = make_node(*static_cast<node_type *>(src)->value());
+		n->parent = parent;
+		n->lchild = nil();
+		n->rchild = nil();
+		n->color = src->color;
+		slot = n;
+		copy_subtree(src->lchild, n, n->lchild);
+		copy_subtree(src->rchild, n, n->rchild);
+	}
+};
+
+} /* namespace rb */
+
+#endif /* RBTREE_HPP */
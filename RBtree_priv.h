@@ -2,7 +2,12 @@
 #define RBTREE_PRIV_H
 
 #include "RBtree.h"
+#include "RBload_priv.h"
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 typedef struct rb_node {
 	int key;
@@ -11,54 +16,327 @@ typedef struct rb_node {
 		       *rchild;
 	char color;
 } *rb_node;
+/* A chunk of nodes belonging to one tree's arena */
+struct rb_slab {
+	struct rb_slab *next;
+	size_t len; /* number of nodes */
+	struct rb_node nodes[];
+};
+/* Slabs shared by trees that have been split or joined, whose nodes may be
+ * in any of them. An arena is freed, along with the arenas it was made from,
+ * when the last tree using it is. */
+struct rb_arena {
+	atomic_uint refs;
+	struct rb_slab *slabs;
+	struct rb_arena *parents[2];
+	struct rb_arena *next; /* used while freeing */
+};
+/* RBsearch's counters for the threads that share a slot. Each slot has a
+ * cache line to itself, so searching threads don't take lines from each
+ * other, from the writer, or from RBsearch_concurrent readers. */
+#define RB_STAT_SLOTS 16
+#define RB_STAT_LINE  64
+struct rb_search_counts {
+	atomic_size_t searches, steps;
+	char pad[RB_STAT_LINE - 2 * sizeof(atomic_size_t)];
+};
+/* What a tree has been doing since it was created. Everything but the search
+ * counters is only touched by the writer; see RB_STAT. */
+struct rb_counters {
+	size_t inserts, deletes, rotations;
+	size_t insert_case[3], delete_case[4];
+	size_t pool_hits, pool_fresh, slab_reuses, slab_mallocs;
+	char gap[RB_STAT_LINE];  /* keeps search[0] off the lines above */
+	struct rb_search_counts search[RB_STAT_SLOTS];
+};
+/* Counting costs an increment of a word the writer has in cache anyway.
+ * Build with -DRB_NO_STATS to leave it out; RBstats then reports zeros.
+ * RBsearch may run in several threads at once, so each thread counts in a
+ * slot of its own (see rb_stat_claim) and RBstats adds the slots up. */
+#ifndef RB_NO_STATS
+#	define RB_STAT(tree, field) ((tree)->stats.field++)
+#	define RB_STAT_SEARCH(tree, steps) rb_stat_search((tree), (steps))
+#else
+#	define RB_STAT(tree, field) ((void)0)
+#	define RB_STAT_SEARCH(tree, steps) ((void)(steps))
+#endif
 struct rb_tree {
 	rb_node root;
 	rb_node nil;
+	/* Node arena: the slabs this tree owns, a bump pointer into the newest
+	 * one, and a list (linked through parent) of nodes given back. */
+	struct rb_slab *slabs;
+	rb_node bump, bump_end;
+	rb_node free_nodes;
+	size_t next_slab_len;
+	/* Slabs shared with other trees, or NULL */
+	struct rb_arena *shared;
+	/* Version for lock-free readers: odd while a write is in progress */
+	atomic_uint seq;
+	/* Operation counters, reported by RBstats */
+	struct rb_counters stats;
+};
+
+/* The nil sentinel shared by every tree. Nothing ever writes to it, so
+ * readers can follow it while a writer works. */
+static struct rb_node rb_nil = { 0, &rb_nil, &rb_nil, &rb_nil, 'b' };
+
+/* A node of a bucketed tree: a sorted block of keys hung off a plain node,
+ * whose key is the block's smallest. Unused slots hold INT_MAX so searches can
+ * always scan the whole block. The blocks are also linked in key order. */
+#define RB_BUCKET_KEYS 32
+struct rb_bucket {
+	_Alignas(64) int keys[RB_BUCKET_KEYS];
+	int count;
+	struct rb_bucket *prev, *next;
+	struct rb_node node;
+};
+struct rb_btree {
+	struct rb_tree tree; /* the tree of buckets */
+	struct rb_bucket *first;
+	size_t count, nbuckets;
 };
+/* Returns the bucket a node of a bucketed tree belongs to. */
+#define rb_bucket_of(n) \
+	((struct rb_bucket *)((char *)(n) - offsetof(struct rb_bucket, node)))
 
-/* Our pool of nodes for faster allocation */
-static rb_node rb_mem_pool = NULL;
+/* Slabs start at RB_SLAB_MIN nodes and double up to RB_SLAB_MAX. */
+#define RB_SLAB_MIN 32
+#define RB_SLAB_MAX 4096
+
+/* Full-sized slabs given back by freed trees are kept for the next tree.
+ * Each thread has a small private cache of them, which spills into (and is
+ * refilled from) a depot shared by all threads. */
+struct rb_slab_cache {
+	struct rb_slab *slabs;
+	size_t count;
+	struct rb_slab_cache *next; /* in the list of all threads' caches */
+	int registered;
+};
+/* Most slabs a thread keeps for itself */
+#define RB_CACHE_SLABS 16
+
+/* This thread's cache */
+static _Thread_local struct rb_slab_cache rb_cache;
+/* The shared depot, a lock-free stack. Threads only ever push onto it or take
+ * the whole thing at once, so there is no ABA problem. */
+static struct rb_slab *_Atomic rb_slab_depot = NULL;
+/* Every thread's cache, so RBcleanup() can drain them. Only touched when a
+ * thread first caches a slab or exits, so a plain mutex is fine. */
+static struct rb_slab_cache *rb_caches = NULL;
+static pthread_mutex_t rb_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Runs rb_cache_exit() when a thread with a cache exits */
+static pthread_key_t rb_cache_key;
+static pthread_once_t rb_cache_once = PTHREAD_ONCE_INIT;
 
 
 /* Section 1: Creating and freeing trees and nodes */
-/* Helper routine: frees a subtree rooted at specified node. */
-static void rb_free_subtree(rb_tree tree, rb_node node);
-/* Creates a new node, taking from the memory pool if available. */
+/* Sets up an empty tree with no slabs. */
+static void rb_init_tree(rb_tree tree);
+/* Zeroes a new tree's counters. */
+static void rb_init_stats(rb_tree tree);
+/* Creates a new node, taking it from the tree's arena. */
 static rb_node rb_new_node(rb_tree tree, int data);
-/* Frees a node to the memory pool. */
-static void rb_free_node(rb_node node);
+/* Gives a node back to the tree's arena. */
+static void rb_free_node(rb_tree tree, rb_node node);
+/* Adds a slab of len nodes to the tree's arena. */
+static struct rb_slab *rb_new_slab(rb_tree tree, size_t len);
+/* Frees a list of slabs, keeping the full-sized ones for later. */
+static void rb_free_slabs(struct rb_slab *slabs);
+/* Allocates an arena with no slabs, no parents and one reference. */
+static struct rb_arena *rb_arena_new();
+/* Drops a reference to an arena (which may be NULL), freeing it and any of
+ * its parents no longer used. */
+static void rb_arena_release(struct rb_arena *arena);
+/* Takes a spare full-sized slab from this thread's cache or the depot. */
+static struct rb_slab *rb_get_slab();
+/* Keeps a full-sized slab for later. */
+static void rb_put_slab(struct rb_slab *slab);
+/* Lists this thread's cache for RBcleanup() and flushes it at thread exit. */
+static void rb_cache_register();
+/* Pushes the chain of slabs first..last onto the depot. */
+static void rb_depot_push(struct rb_slab *first, struct rb_slab *last);
+/* Creates the key whose destructor flushes a thread's cache. */
+static void rb_cache_init();
+/* Flushes an exiting thread's cache into the depot. */
+static void rb_cache_exit(void *cache);
+/* Helper routine: links keys[lo..hi) into a balanced subtree of nodes[lo..hi).
+ * Nodes at depth red_depth are colored red. */
+static rb_node rb_build_subtree(rb_tree tree, rb_node nodes, const int *keys,
+		size_t lo, size_t hi, int depth, int red_depth);
+/* Returns the number of nodes in a tree. */
+static size_t rb_count_nodes(rb_tree tree);
+/* A Red-Black tree of n nodes is at most 2*log2(n+1) high, which is under
+ * this for any n a size_t can count. */
+#define RB_MAX_HEIGHT 128
 
 /* Section 2: Insertion */
+/* Links a new node in below parent and restores the Red-Black properties. */
+static void rb_link_node(rb_tree tree, rb_node newnode, rb_node newparent);
 /* Corrects for properties violated on an insertion. */
 static void rb_insert_fix(rb_tree tree, rb_node n);
 /* Helper routine: returns the uncle of a given node. */
 static rb_node rb_get_uncle(rb_tree tree, rb_node n);
 
 /* Section 3: Deletion */
+/* Takes a node out of the tree and restores the Red-Black properties. */
+static void rb_unlink_node(rb_tree tree, rb_node dead);
 /* Helper routine: transplants node `from' into node `to's position. */
 static void rb_transplant(rb_tree tree, rb_node to, rb_node from);
-/* Corrects for properties violated on a deletion. */
-static void rb_delete_fix(rb_tree tree, rb_node n);
+/* Corrects for properties violated on a deletion. n may be tree->nil, so its
+ * parent is passed in separately. */
+static void rb_delete_fix(rb_tree tree, rb_node n, rb_node parent);
 
 /* Section 4: I/O */
-/* Helper routine: write an entire subtree to stdout. */
-static void rb_preorder_write(rb_tree tree, rb_node n);
-/* Reads a tree in preorder format, limited by the maximum value of max. */
-static rb_node rb_read_subtree(rb_tree tree, rb_node *next, int max, FILE *fp);
-/* Helper routine: read a single node from file fp. */
-static rb_node rb_read_node(rb_tree tree, FILE *fp);
-
-/* Section 5: General helper routines */
+/* Returns the node after n in preorder, or nil. */
+static rb_node rb_preorder_next(rb_tree tree, rb_node n);
+/* Writes the decimal form of v to p and returns the number of characters. */
+static int rb_format_int(char *p, int v);
+/* Longest node in the text format: "; r, -2147483648" */
+#define RB_TEXT_NODE 16
+/* Rebuilds a tree into a balanced, correctly colored shape. Returns 0 if out
+ * of memory, leaving the tree as it was. */
+static int rb_rebuild(rb_tree tree);
+/* Builds a tree from the text in s, or returns NULL if it's malformed. */
+static rb_tree rb_read_text(struct rb_scan *s);
+/* Helper routine: makes a node for rb_load_preorder. */
+static rb_load_node rb_load_make(void *tree, int key, int red);
+/* Helper routine: links a node for rb_load_preorder. */
+static void rb_load_link(void *tree, rb_load_node parent, rb_load_node child,
+		int right);
+/* How rb_load_preorder builds an rb_tree */
+static const struct rb_load_ops rb_tree_load = { rb_load_make, rb_load_link };
+
+/* Binary format: an 8-byte header (RB_BIN_MAGIC, then the version as a 32-bit
+ * little-endian number), then the nodes in preorder as RB_BIN_RECORD-byte
+ * records (the key as 32-bit little-endian, then the color 'b' or 'r'), then
+ * the node count and a checksum of the records as 64-bit little-endian
+ * numbers. The records come in chunks, each led by its number of records as
+ * a 32-bit little-endian number, and a chunk of none ends them; so a reader
+ * always knows how many more bytes belong to the tree. Version 1 had no
+ * chunks, and ended the records with one whose color byte is 0. */
+#define RB_BIN_MAGIC   "RBtb"
+#define RB_BIN_VERSION 2
+#define RB_BIN_RECORD  5
+/* A buffered binary stream over a file descriptor */
+struct rb_io {
+	int fd;
+	FILE *fp;           /* if set, output goes here instead of fd */
+	unsigned char *buf;
+	size_t pos, len;    /* read position and end of data in buf */
+	uint64_t left;      /* bytes the reader knows are still to come */
+	uint32_t chunk;     /* records left in the current chunk */
+	int chunked;        /* whether the input is in chunks (version 2) */
+	uint64_t count;     /* records so far */
+	uint64_t sum;       /* checksum of records so far */
+	int done, failed;
+};
+/* Fills in the length of the chunk whose header is at io->buf[at]. */
+static void rb_bin_chunk(struct rb_io *io, size_t at, uint32_t records);
+/* Adds one record to a checksum. */
+static uint64_t rb_bin_mix(uint64_t sum, uint64_t rec);
+
+/* Mapped image format: a 64-byte header, then one rb_image_node per node in
+ * preorder, root first. Every node's left child directly follows it, so only
+ * the right child needs a link. Links are indices into the node array, which
+ * makes the image position-independent, and always point forwards, which
+ * keeps a search of even a corrupt image finite. Images hold native-endian
+ * numbers and are checked against the host's byte order when opened. */
+#define RB_IMAGE_MAGIC   "RBti"
+#define RB_IMAGE_VERSION 1
+#define RB_IMAGE_ORDER   0x01020304u
+struct rb_image_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t order;
+	uint32_t reserved;
+	uint64_t count;
+	char pad[40];
+};
+struct rb_image_node {
+	int32_t key;
+	uint32_t link; /* RB_IMAGE_LEFT, plus the right child's index or 0 */
+};
+#define RB_IMAGE_LEFT  0x80000000u /* the node has a left child */
+#define RB_IMAGE_RIGHT 0x7fffffffu /* mask for the right child's index */
+/* Helper routine: writes n bytes at offset off of the file that io has had
+ * end bytes put into so far, whether or not they have gone out yet. */
+static void rb_image_patch(struct rb_io *io, size_t end, size_t off,
+		const void *p, size_t n);
+/* Appends n bytes to the output buffer, flushing it as needed. */
+static void rb_io_put(struct rb_io *io, const void *p, size_t n);
+/* Writes out everything buffered. */
+static void rb_io_flush(struct rb_io *io);
+/* Returns a pointer to the next n bytes of input, or NULL if there aren't n.
+ * Takes no more than io->left bytes from the fd. */
+static unsigned char *rb_io_get(struct rb_io *io, size_t n);
+/* Helper routine: reads a single node's key and color from struct rb_io *src
+ * for rb_load_preorder. Returns 0 at the end of the records or on error. */
+static int rb_read_binary_node(void *src, int *key, int *red);
+
+/* Section 5: Searching */
+/* Hints the CPU to start loading a node we are about to visit. */
+#if defined(__GNUC__)
+#	define rb_prefetch(p) __builtin_prefetch(p)
+#else
+#	define rb_prefetch(p) ((void)0)
+#endif
+/* Number of descents RBsearch_many() keeps in flight at once */
+#define RB_SEARCH_LANES 8
+/* Loads for the lock-free readers. The writer may change these fields under
+ * us, so the compiler must not cache or re-read them. */
+#define rb_load_node(p) (*(rb_node volatile *)&(p))
+#define rb_load_key(k)  (*(volatile int *)&(k))
+/* Lock-free readers recheck the version every RB_SEQ_CHECK steps, so one
+ * caught in a half-rotated tree gives up rather than walking in circles. */
+#define RB_SEQ_CHECK 64
+/* Helper routine: successor for the lock-free readers. Sets *stale if the
+ * walk ran into a change made after version seq. */
+static rb_node rb_successor_concurrent(rb_tree tree, rb_node n, unsigned seq,
+		int *stale);
+
+/* Section 6: General helper routines */
 /* Returns a node with the given key. */
 static rb_node rb_get_node_by_key(rb_tree haystack, int needle);
 /* Rotates a tree around the given root. */
 static void rb_rotate(rb_tree tree, rb_node root, int go_left);
+#ifndef RB_NO_STATS
+/* Counts a search of tree that stepped past steps nodes. */
+static void rb_stat_search(rb_tree tree, size_t steps);
+/* Gives this thread a search counter slot, its own if one is free. */
+static void rb_stat_claim();
+/* Creates the key whose destructor frees a thread's slot. */
+static void rb_stat_init();
+/* Frees an exiting thread's search counter slot. */
+static void rb_stat_exit(void *slot);
+/* This thread's search counter slot, plus 1; 0 until it first searches */
+static _Thread_local unsigned rb_stat_self = 0;
+/* The slots, of the first RB_STAT_SLOTS - 1, that a thread holds. The last
+ * slot is shared by the threads that found none free. */
+static atomic_uint rb_stat_held = 0;
+/* Runs rb_stat_exit() when a thread holding a slot exits */
+static pthread_key_t rb_stat_key;
+static pthread_once_t rb_stat_once = PTHREAD_ONCE_INIT;
+#endif
 /* Returns minimum node in the given subtree. */
 static rb_node rb_min(rb_tree tree, rb_node node);
+/* Returns maximum node in the given subtree. */
+static rb_node rb_max(rb_tree tree, rb_node node);
+/* Returns the in-order successor of a node, or tree->nil if it has none. */
+static rb_node rb_successor(rb_tree tree, rb_node node);
+/* Returns the in-order predecessor of a node, or tree->nil if it has none. */
+static rb_node rb_predecessor(rb_tree tree, rb_node node);
 /* Computes height of the tree rooted at node n. */
 static int rb_height(rb_tree tree, rb_node n);
+/* Marks the start and end of a change that lock-free readers could see. */
+static void rb_write_begin(rb_tree tree);
+static void rb_write_end(rb_tree tree);
+/* Waits for a moment when no write is in progress and returns the version. */
+static unsigned rb_read_begin(rb_tree tree);
+/* Returns nonzero if the tree has changed since version seq. */
+static int rb_read_stale(rb_tree tree, unsigned seq);
 
-/* Section 6: SVG */
+/* Section 7: SVG */
 #define RADIUS    15.0 /* Radius of each node */
 #define PADDING   10.0 /* Padding between nodes */
 #define MAXWIDTH  1000 /* Maximum width of an image in px */
@@ -70,4 +348,157 @@ static void rb_draw_subtree(FILE *fp, rb_tree tree, rb_node n, double x,
  * its row. factor corrects for an image which would be greater than MAXWIDTH. */
 static double calcpos(int exp, int rowpos, double factor);
 
+/* Section 8: Bucketed trees */
+/* Returns the bucket whose range key falls in: the last one starting at or
+ * before key, or the first bucket if key is below all of them. */
+static struct rb_bucket *rb_bucket_find(rb_btree bt, int key);
+/* Returns the number of keys in a bucket less than key. */
+static int rb_bucket_rank(const struct rb_bucket *b, int key);
+/* Allocates an empty bucket. */
+static struct rb_bucket *rb_bucket_new();
+/* Adds a bucket to the tree after prev (or first, if prev is NULL). */
+static void rb_bucket_link(rb_btree bt, struct rb_bucket *b,
+		struct rb_bucket *prev);
+/* Removes a bucket from the tree and frees it. */
+static void rb_bucket_unlink(rb_btree bt, struct rb_bucket *b);
+
+/* Section 9: Mapped images */
+struct rb_mapped {
+	void *map;
+	size_t map_len;
+	const struct rb_image_node *nodes;
+	size_t count;
+};
+
+/* Section 10: Tracing */
+#ifndef RB_TRACE
+#	define RB_TRACE 0
+#endif
+/* Reports an event if the library was built with RB_TRACE >= level and
+ * someone is listening. With a lower RB_TRACE this is a constant false
+ * condition and compiles to nothing; otherwise it costs a load and a branch
+ * until a hook is set or recording is started. */
+#define RB_TRACE_EVENT(level, tree, op, arg, key) do { \
+	if ((level) <= RB_TRACE && \
+	    atomic_load_explicit(&rb_tracing, memory_order_relaxed)) { \
+		rb_trace((tree), (op), (arg), (key)); \
+	} \
+} while (0)
+/* Number of events the ring holds; a power of two */
+#define RB_TRACE_RING 4096
+/* A slot of the ring. Like a tree, each slot has its own version: 0 while an
+ * event is being written to it, and the event's number once it's there. */
+struct rb_trace_slot {
+	_Atomic unsigned long long seq;
+	struct rb_trace_event event;
+};
+/* Nonzero while there is a hook or recording is on */
+static atomic_int rb_tracing = 0;
+static atomic_int rb_trace_recording = 0;
+static void (*rb_trace_fn)(const struct rb_trace_event *e, void *arg) = NULL;
+static void *rb_trace_arg = NULL;
+/* Events recorded so far; each writer takes the next one and owns its slot */
+static _Atomic unsigned long long rb_trace_next = 0;
+static struct rb_trace_slot rb_trace_ring[RB_TRACE_RING];
+/* Reports an event to the hook and the ring. */
+static void rb_trace(rb_tree tree, int op, int arg, int key);
+
+/* Section 11: Splitting and joining */
+/* Returns the black height of the subtree at n, counting n. */
+static int rb_black_height(rb_tree tree, rb_node n);
+/* Returns nonzero if a tree owns any nodes, so taking over its nodes means
+ * taking over its slabs. */
+#define rb_has_slabs(tree) ((tree)->slabs != NULL || (tree)->shared != NULL)
+/* Moves other's slabs and arena into tree, by way of arena. Does nothing if
+ * arena is NULL (which it may be if other has no slabs). */
+static void rb_take_slabs(rb_tree tree, rb_tree other, struct rb_arena *arena);
+/* Helper routine: splits the subtree at n, of black height bh, into the keys
+ * below key, the node with key (or nil) and the keys above it. tree lends a
+ * root to the joins. */
+static void rb_split_subtree(rb_tree tree, rb_node n, int bh, int key,
+		rb_node *lo, int *lobh, rb_node *match, rb_node *hi, int *hibh);
+/* Helper routine: joins subtrees l and r, of black heights lbh and rbh, with
+ * nothing between them. Returns the new root and sets *bh. */
+static rb_node rb_join2_subtrees(rb_tree tree, rb_node l, int lbh, rb_node r,
+		int rbh, int *bh);
+/* Helper routine: joins subtrees l and r, of black heights lbh and rbh, with
+ * m between them. Returns the new root and sets *bh to its black height. */
+static rb_node rb_join_subtrees(rb_tree tree, rb_node l, int lbh, rb_node m,
+		rb_node r, int rbh, int *bh);
+/* RBdelete_range deletes fewer keys than this one at a time, which is quicker
+ * than two splits and a join */
+#define RB_RANGE_SPLIT 64
+/* Gives every node of the detached subtree at n back to the tree's arena, and
+ * returns how many there were. */
+static size_t rb_free_subtree(rb_tree tree, rb_node n);
+
+/* Section 12: Set operations */
+/* A piece of work for the pool. done is set once run has returned. */
+struct rb_task {
+	void (*run)(struct rb_task *task);
+	atomic_int done;
+};
+/* Most threads in the pool, counting the one that started the operation */
+#define RB_POOL_MAX 64
+/* Each thread only queues tasks it forks on its way down a tree, so this is
+ * far more than the depth of any tree */
+#define RB_DEQUE_MAX 256
+/* A thread's queue of forked tasks. The owner pushes and pops at the bottom;
+ * idle threads steal from the top, where the biggest tasks are. */
+struct rb_deque {
+	struct rb_task *tasks[RB_DEQUE_MAX];
+	int top, bottom;
+};
+/* The pool. The tasks are coarse (see RB_SET_GRAIN), so one lock for all the
+ * queues costs nothing noticeable. */
+static struct rb_deque rb_deques[RB_POOL_MAX];
+static pthread_t rb_pool_threads[RB_POOL_MAX];
+static int rb_pool_size = 0; /* threads, counting the caller; 0 until started */
+static int rb_pool_stop = 0;
+static pthread_mutex_t rb_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rb_pool_wake = PTHREAD_COND_INITIALIZER;
+/* Held for a whole set operation: the caller works as queue 0 */
+static pthread_mutex_t rb_pool_user = PTHREAD_MUTEX_INITIALIZER;
+/* This thread's queue */
+static _Thread_local int rb_pool_self = 0;
+/* Subtrees of at least this black height (so at least 2^RB_SET_GRAIN - 1
+ * nodes) are worth handing to another thread */
+#define RB_SET_GRAIN 10
+
+/* Which set operation a task does */
+enum { RB_UNION, RB_INTERSECT, RB_DIFFERENCE };
+/* One step of a set operation: combine subtrees a and b into root. */
+struct rb_set_task {
+	struct rb_task task;
+	int op;
+	rb_node a, b;
+	int abh, bbh;
+	rb_node root;
+	int bh;
+	/* Subtrees left out of root, linked through their roots' parents */
+	rb_node dropped, dropped_last;
+};
+
+/* Starts the pool's threads if they aren't running. */
+static void rb_pool_start();
+/* Body of a pool thread. */
+static void *rb_pool_worker(void *self);
+/* Takes a task: the newest from this thread's queue, or else the oldest from
+ * another's. Returns NULL if there are none. Called with rb_pool_lock held. */
+static struct rb_task *rb_pool_take();
+/* Queues a task for any thread to run, or runs it now if it can't be. */
+static void rb_fork(struct rb_task *task);
+/* Waits for a forked task to finish, running other tasks meanwhile. */
+static void rb_sync(struct rb_task *task);
+/* Stops the pool's threads. */
+static void rb_pool_stop_all();
+/* Runs a set operation on two whole trees, leaving the result in a. */
+static rb_tree rb_set_op(rb_tree a, rb_tree b, int op);
+/* Runs a set operation task. */
+static void rb_set_run(struct rb_task *task);
+/* Helper routine: lists the subtree at n as dropped from a task's result. */
+static void rb_set_drop(struct rb_set_task *t, rb_node n);
+/* Helper routine: adds the subtrees a subtask dropped to a task's list. */
+static void rb_set_gather(struct rb_set_task *t, struct rb_set_task *sub);
+
 #endif /* RBTREE_PRIV_H */
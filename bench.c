@@ -0,0 +1,861 @@
+#define _POSIX_C_SOURCE 200112L
+#include "bench.h"
+#include "RBtree.h"
+#include "RBshard.h"
+#include "RBcompact.h"
+#include "RBlean.h"
+#include "RBpersist.h"
+#include "RBfrozen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Default number of keys in the tree */
+#define DEFAULT_N 1000000
+/* Scratch file for the I/O benchmark */
+#define BENCH_FILE "/tmp/rbtree-bench.tmp"
+
+/* Returns the current time in seconds. */
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/* Returns the resident set size of the process in bytes, or 0 if unknown. */
+static size_t rss() {
+	unsigned long pages = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL) return 0;
+	if (fscanf(fp, "%lu %lu", &pages, &resident) != 2) resident = 0;
+	fclose(fp);
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+/* Returns the i'th key of a fixed pseudo-random sequence. Multiplying by an
+ * odd constant is a bijection on 32 bits, so no key repeats. */
+int bench_key(size_t i) {
+	return (int)(unsigned)(i * 2654435761u);
+}
+/* Builds a tree holding bench_key(0) .. bench_key(n-1). */
+static rb_tree bench_tree(size_t n) {
+	rb_tree tree = RBcreate();
+	size_t i;
+	for (i = 0; i < n; i++) {
+		RBinsert(tree, bench_key(i));
+	}
+	return tree;
+}
+/* Returns an array of n lookup keys, about half of which are in a tree built
+ * by bench_tree(n). */
+static int *bench_queries(size_t n) {
+	int *q = malloc(n * sizeof(*q));
+	size_t i;
+	srand(310);
+	for (i = 0; i < n; i++) {
+		size_t r = ((size_t)rand() << 16) ^ (size_t)rand();
+		q[i] = bench_key(r % (2 * n));
+	}
+	return q;
+}
+/* Prints one result line. */
+void report(const char *name, size_t n, size_t ops, double secs) {
+	printf("%-24s n=%-10lu %8.1f ns/op %8.2f Mops/s\n", name,
+		(unsigned long)n, secs * 1e9 / ops, ops / secs / 1e6);
+}
+
+/* Point lookups: one at a time versus RBsearch_many(). */
+static void bench_lookup(size_t n) {
+	rb_tree tree = bench_tree(n);
+	int *q = bench_queries(n);
+	int *out = malloc(n * sizeof(*out));
+	size_t i, found1 = 0, found2;
+	double t;
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		found1 += RBsearch(tree, q[i]);
+	}
+	report("lookup/RBsearch", n, n, now() - t);
+
+	t = now();
+	found2 = RBsearch_many(tree, q, n, out);
+	report("lookup/RBsearch_many", n, n, now() - t);
+
+	if (found1 != found2) {
+		fprintf(stderr, "Error: RBsearch found %lu, RBsearch_many %lu.\n",
+			(unsigned long)found1, (unsigned long)found2);
+	}
+	free(out);
+	free(q);
+	RBfree(tree);
+}
+
+/* Loading sorted keys: n calls to RBinsert() versus RBbuild_sorted(). */
+static void bench_build(size_t n) {
+	int *keys = malloc(n * sizeof(*keys));
+	rb_tree tree;
+	size_t i;
+	double t;
+	for (i = 0; i < n; i++) {
+		keys[i] = (int)i;
+	}
+
+	t = now();
+	tree = RBcreate();
+	for (i = 0; i < n; i++) {
+		RBinsert(tree, keys[i]);
+	}
+	report("build/RBinsert", n, n, now() - t);
+	RBfree(tree);
+
+	t = now();
+	tree = RBbuild_sorted(keys, n);
+	report("build/RBbuild_sorted", n, n, now() - t);
+	RBfree(tree);
+	free(keys);
+}
+
+/* Node allocation and teardown: fill a tree, free it, then do it again so the
+ * second round can reuse whatever memory the first one gave back. */
+static void bench_alloc(size_t n) {
+	rb_tree tree;
+	size_t i;
+	int round;
+	double t;
+	for (round = 1; round <= 2; round++) {
+		t = now();
+		tree = RBcreate();
+		for (i = 0; i < n; i++) {
+			RBinsert(tree, bench_key(i));
+		}
+		report(round == 1 ? "alloc/insert-cold" : "alloc/insert-warm",
+			n, n, now() - t);
+		t = now();
+		RBfree(tree);
+		report(round == 1 ? "alloc/RBfree-cold" : "alloc/RBfree-warm",
+			n, n, now() - t);
+	}
+}
+
+/* Each thread inserts and then deletes n keys in its own tree, twice. */
+static void *bench_threads_worker(void *arg) {
+	size_t n = *(size_t *)arg;
+	size_t i;
+	int round;
+	for (round = 0; round < 2; round++) {
+		rb_tree tree = RBcreate();
+		for (i = 0; i < n; i++) {
+			RBinsert(tree, bench_key(i));
+		}
+		for (i = 0; i < n; i++) {
+			RBdelete(tree, bench_key(i));
+		}
+		RBfree(tree);
+	}
+	return NULL;
+}
+/* Insert/delete throughput with 1, 2, 4, ... threads, each owning a tree. */
+static void bench_threads(size_t n) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t tids[64];
+	long nthreads, i;
+	double t;
+	char name[32];
+	if (ncpu < 1) ncpu = 1;
+	for (nthreads = 1; nthreads <= 64; nthreads *= 2) {
+		t = now();
+		for (i = 0; i < nthreads; i++) {
+			pthread_create(&tids[i], NULL, bench_threads_worker, &n);
+		}
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(tids[i], NULL);
+		}
+		sprintf(name, "threads/%ld", nthreads);
+		report(name, n, 4 * n * nthreads, now() - t);
+		if (nthreads >= ncpu) break;
+	}
+}
+
+/* Shared state for the concurrent-readers benchmark */
+static struct {
+	rb_tree tree;
+	size_t n;
+	volatile int stop;
+	long write_rate; /* writes per second, 0 for none */
+} conc;
+/* Looks up random keys until told to stop; returns the count. */
+static void *bench_concurrent_reader(void *arg) {
+	unsigned seed = (unsigned)(size_t)arg;
+	size_t reads = 0;
+	while (!conc.stop) {
+		RBsearch_concurrent(conc.tree, bench_key(rand_r(&seed) % conc.n));
+		reads++;
+	}
+	return (void *)reads;
+}
+/* Deletes and reinserts keys at conc.write_rate per second. */
+static void *bench_concurrent_writer(void *arg) {
+	unsigned seed = 1;
+	struct timespec pause;
+	pause.tv_sec = 0;
+	pause.tv_nsec = 1000000; /* write in 1ms batches */
+	while (!conc.stop) {
+		long i;
+		for (i = 0; i < conc.write_rate / 1000; i += 2) {
+			int key = bench_key(rand_r(&seed) % conc.n);
+			RBdelete(conc.tree, key);
+			RBinsert(conc.tree, key);
+		}
+		nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+/* Lock-free read throughput with no writer, then with a steady writer. */
+static void bench_concurrent(size_t n) {
+	long nreaders = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	long rates[] = { 0, 100000 };
+	pthread_t readers[64], writer;
+	struct timespec run;
+	long i;
+	int r;
+	char name[40];
+	if (nreaders < 1) nreaders = 1;
+	if (nreaders > 64) nreaders = 64;
+	conc.tree = bench_tree(n);
+	conc.n = n;
+	run.tv_sec = 1;
+	run.tv_nsec = 0;
+	for (r = 0; r < 2; r++) {
+		size_t reads = 0;
+		conc.stop = 0;
+		conc.write_rate = rates[r];
+		for (i = 0; i < nreaders; i++) {
+			pthread_create(&readers[i], NULL, bench_concurrent_reader,
+				(void *)(size_t)(i + 1));
+		}
+		if (conc.write_rate > 0) {
+			pthread_create(&writer, NULL, bench_concurrent_writer, NULL);
+		}
+		nanosleep(&run, NULL);
+		conc.stop = 1;
+		for (i = 0; i < nreaders; i++) {
+			void *ret;
+			pthread_join(readers[i], &ret);
+			reads += (size_t)ret;
+		}
+		if (conc.write_rate > 0) {
+			pthread_join(writer, NULL);
+		}
+		sprintf(name, "concurrent/%ldr+%ldw/s", nreaders, conc.write_rate);
+		report(name, n, reads, 1.0);
+	}
+	RBfree(conc.tree);
+}
+
+/* Memory per key and lookup latency, rb_tree versus rb_compact. */
+static void bench_compact(size_t n) {
+	int *q = bench_queries(n);
+	size_t i, before, found = 0;
+	double t;
+	char name[40];
+	rb_tree tree;
+	rb_compact ctree;
+
+	before = rss();
+	tree = bench_tree(n);
+	printf("%-24s n=%-10lu %8.1f bytes/key (RSS)\n", "compact/rb_tree",
+		(unsigned long)n, (double)(rss() - before) / n);
+	t = now();
+	for (i = 0; i < n; i++) {
+		found += RBsearch(tree, q[i]);
+	}
+	report("compact/rb_tree-lookup", n, n, now() - t);
+	RBfree(tree);
+	RBcleanup();
+
+	before = rss();
+	ctree = RBcompact_create();
+	for (i = 0; i < n; i++) {
+		RBcompact_insert(ctree, bench_key(i));
+	}
+	sprintf(name, "%.1f bytes/key", (double)RBcompact_memory(ctree) / n);
+	printf("%-24s n=%-10lu %8.1f bytes/key (RSS), %s allocated\n",
+		"compact/rb_compact", (unsigned long)n,
+		(double)(rss() - before) / n, name);
+	t = now();
+	for (i = 0; i < n; i++) {
+		found -= RBcompact_search(ctree, q[i]);
+	}
+	report("compact/rb_compact-lookup", n, n, now() - t);
+	if (found != 0) {
+		fprintf(stderr, "Error: rb_tree and rb_compact disagree.\n");
+	}
+	RBcompact_free(ctree);
+	free(q);
+}
+
+/* Insert-heavy and delete-heavy workloads, rb_tree (parent pointers, fixups
+ * climb the parent links) versus rb_lean (no parent pointers, fixups climb a
+ * path stack). */
+static void bench_lean(size_t n) {
+	rb_tree tree = RBcreate();
+	rb_lean ltree = RBlean_create();
+	size_t i;
+	double t;
+
+	t = now();
+	for (i = 0; i < n; i++) RBinsert(tree, bench_key(i));
+	report("lean/rb_tree-insert", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) RBlean_insert(ltree, bench_key(i));
+	report("lean/rb_lean-insert", n, n, now() - t);
+
+	t = now();
+	for (i = 0; i < n; i++) RBdelete(tree, bench_key(i));
+	report("lean/rb_tree-delete", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) RBlean_delete(ltree, bench_key(i));
+	report("lean/rb_lean-delete", n, n, now() - t);
+
+	RBfree(tree);
+	RBlean_free(ltree);
+}
+
+/* What versioning costs a writer: rb_persist inserting and deleting with no
+ * snapshot alive (every node is the live tree's, so it changes in place like
+ * rb_lean), with a snapshot taken every 1000 writes, and with one taken before
+ * every write, so that each write copies its whole path. The old snapshot is
+ * released as each new one is taken. */
+static void bench_persist(size_t n) {
+	static const size_t every[] = { 0, 1000, 1 };
+	static const char *names[][2] = {
+		{ "persist/none-insert", "persist/none-delete" },
+		{ "persist/1000-insert", "persist/1000-delete" },
+		{ "persist/1-insert", "persist/1-delete" },
+	};
+	rb_tree tree = RBcreate();
+	size_t i, k;
+	double t;
+
+	t = now();
+	for (i = 0; i < n; i++) RBinsert(tree, bench_key(i));
+	report("persist/rb_tree-insert", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) RBdelete(tree, bench_key(i));
+	report("persist/rb_tree-delete", n, n, now() - t);
+	RBfree(tree);
+
+	for (k = 0; k < sizeof(every) / sizeof(every[0]); k++) {
+		rb_persist ptree = RBpersist_create();
+		rb_version v = NULL;
+		int pass;
+		for (pass = 0; pass < 2; pass++) {
+			t = now();
+			for (i = 0; i < n; i++) {
+				if (every[k] != 0 && i % every[k] == 0) {
+					if (v != NULL) RBversion_release(v);
+					v = RBsnapshot(ptree);
+				}
+				if (pass == 0) {
+					RBpersist_insert(ptree, bench_key(i));
+				} else {
+					RBpersist_delete(ptree, bench_key(i));
+				}
+			}
+			report(names[k][pass], n, n, now() - t);
+		}
+		if (v != NULL) RBversion_release(v);
+		RBpersist_free(ptree);
+	}
+}
+
+/* Memory and speed of the bucketed tree against the plain one. */
+static void bench_bucket(size_t n) {
+	int *q = bench_queries(n);
+	size_t i, before, found = 0;
+	double t;
+	char name[40];
+	rb_tree tree;
+	rb_btree bt;
+
+	before = rss();
+	tree = RBcreate();
+	t = now();
+	for (i = 0; i < n; i++) RBinsert(tree, bench_key(i));
+	report("bucket/rb_tree-insert", n, n, now() - t);
+	printf("%-24s n=%-10lu %8.1f bytes/key (RSS)\n", "bucket/rb_tree",
+		(unsigned long)n, (double)(rss() - before) / n);
+	t = now();
+	for (i = 0; i < n; i++) found += RBsearch(tree, q[i]);
+	report("bucket/rb_tree-lookup", n, n, now() - t);
+	RBfree(tree);
+	RBcleanup();
+
+	before = rss();
+	bt = RBbucket_create();
+	t = now();
+	for (i = 0; i < n; i++) RBbucket_insert(bt, bench_key(i));
+	report("bucket/rb_btree-insert", n, n, now() - t);
+	sprintf(name, "%.1f bytes/key", (double)RBbucket_memory(bt) / n);
+	printf("%-24s n=%-10lu %8.1f bytes/key (RSS), %s allocated\n",
+		"bucket/rb_btree", (unsigned long)n,
+		(double)(rss() - before) / n, name);
+	t = now();
+	for (i = 0; i < n; i++) found -= RBbucket_search(bt, q[i]);
+	report("bucket/rb_btree-lookup", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) RBbucket_delete(bt, bench_key(i));
+	report("bucket/rb_btree-delete", n, n, now() - t);
+	if (found != 0) {
+		fprintf(stderr, "Error: rb_tree and rb_btree disagree.\n");
+	}
+	RBbucket_free(bt);
+	free(q);
+}
+
+/* Prints throughput for reading or writing a file of the given size. */
+static void report_io(char *name, size_t n, off_t bytes, double secs) {
+	printf("%-24s n=%-10lu %8.1f ns/node %8.1f MB/s\n", name,
+		(unsigned long)n, secs * 1e9 / n, bytes / secs / 1e6);
+}
+
+/* Saving and loading in the text format versus the binary one. */
+static void bench_io(size_t n) {
+	rb_tree tree = bench_tree(n), back;
+	FILE *fp;
+	int fd;
+	off_t bytes;
+	double t;
+
+	fp = fopen(BENCH_FILE, "w");
+	t = now();
+	RBwrite_to(tree, fp);
+	t = now() - t;
+	bytes = ftell(fp);
+	fclose(fp);
+	report_io("io/RBwrite_to", n, bytes, t);
+	t = now();
+	back = RBread(BENCH_FILE);
+	report_io("io/RBread", n, bytes, now() - t);
+	RBfree(back);
+	t = now();
+	back = RBread_mmap(BENCH_FILE);
+	report_io("io/RBread_mmap", n, bytes, now() - t);
+	RBfree(back);
+	fp = fopen(BENCH_FILE, "w");
+	t = now();
+	RBwrite_sorted_to(tree, fp);
+	t = now() - t;
+	bytes = ftell(fp);
+	fclose(fp);
+	report_io("io/RBwrite_sorted_to", n, bytes, t);
+
+	fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	t = now();
+	RBwrite_binary(tree, fd);
+	t = now() - t;
+	bytes = lseek(fd, 0, SEEK_END);
+	report_io("io/RBwrite_binary", n, bytes, t);
+	lseek(fd, 0, SEEK_SET);
+	t = now();
+	back = RBread_binary(fd);
+	report_io("io/RBread_binary", n, bytes, now() - t);
+	close(fd);
+	if (back == NULL) {
+		fprintf(stderr, "Error: binary round trip failed.\n");
+	} else {
+		/* A loaded tree has its nodes in preorder in memory, so this
+		 * shows the cost of formatting rather than of cache misses */
+		fp = fopen(BENCH_FILE, "w");
+		t = now();
+		RBwrite_to(back, fp);
+		t = now() - t;
+		bytes = ftell(fp);
+		fclose(fp);
+		report_io("io/RBwrite_to-loaded", n, bytes, t);
+		RBfree(back);
+	}
+	unlink(BENCH_FILE);
+	RBfree(tree);
+}
+
+/* Prints the time taken by a single whole-tree operation. */
+static void report_once(char *name, size_t n, double secs) {
+	printf("%-24s n=%-10lu %10.3f ms\n", name, (unsigned long)n, secs * 1e3);
+}
+
+/* Startup and lookups for a mapped image versus loading the tree. */
+static void bench_mapped(size_t n) {
+	rb_tree tree = bench_tree(n), back;
+	int *q = bench_queries(n);
+	rb_mapped m;
+	size_t i, found = 0;
+	int fd;
+	double t;
+
+	fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	RBwrite_binary(tree, fd);
+	lseek(fd, 0, SEEK_SET);
+	t = now();
+	back = RBread_binary(fd);
+	report_once("mapped/RBread_binary", n, now() - t);
+	close(fd);
+	RBfree(back);
+
+	t = now();
+	RBwrite_image(tree, BENCH_FILE);
+	report("mapped/RBwrite_image", n, n, now() - t);
+	t = now();
+	m = RBopen_mapped(BENCH_FILE);
+	report_once("mapped/RBopen_mapped", n, now() - t);
+	if (m == NULL) {
+		RBfree(tree);
+		free(q);
+		return;
+	}
+	t = now();
+	for (i = 0; i < n; i++) found += RBsearch(tree, q[i]);
+	report("mapped/live-RBsearch", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) found -= RBmapped_search(m, q[i]);
+	report("mapped/RBmapped_search", n, n, now() - t);
+	if (found != 0) {
+		fprintf(stderr, "Error: rb_tree and rb_mapped disagree.\n");
+	}
+	RBclose_mapped(m);
+	unlink(BENCH_FILE);
+	RBfree(tree);
+	free(q);
+}
+
+/* Lookups on the live tree versus a frozen copy of it. */
+static void bench_frozen(size_t n) {
+	rb_tree tree = bench_tree(n);
+	int *q = bench_queries(n);
+	int *out = malloc(n * sizeof(*out));
+	rb_frozen fr;
+	size_t i, found[4] = { 0, 0, 0, 0 };
+	double t;
+
+	t = now();
+	fr = RBfreeze(tree);
+	report("frozen/RBfreeze", n, n, now() - t);
+
+	t = now();
+	for (i = 0; i < n; i++) found[0] += RBsearch(tree, q[i]);
+	report("frozen/live-RBsearch", n, n, now() - t);
+	t = now();
+	found[1] = RBsearch_many(tree, q, n, out);
+	report("frozen/live-RBsearch_many", n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) found[2] += RBfrozen_search(fr, q[i]);
+	report("frozen/RBfrozen_search", n, n, now() - t);
+	t = now();
+	found[3] = RBfrozen_search_many(fr, q, n, out);
+	report("frozen/RBfrozen_search_many", n, n, now() - t);
+
+	for (i = 1; i < 4; i++) {
+		if (found[i] != found[0]) {
+			fprintf(stderr, "Error: frozen lookups disagree.\n");
+		}
+	}
+	RBfrozen_free(fr);
+	free(out);
+	free(q);
+	RBfree(tree);
+}
+
+/* Shared state for the sharded benchmarks */
+static struct {
+	rb_shards shards;     /* the sharded container, or... */
+	rb_tree tree;         /* ...one tree behind one lock */
+	pthread_mutex_t lock;
+	size_t n;
+	long nthreads;
+	int lookup;           /* look the keys up rather than insert them */
+} shard;
+/* Inserts or looks up every nthreads'th key, starting at the given offset. */
+static void *bench_shards_worker(void *arg) {
+	size_t i;
+	for (i = (size_t)arg; i < shard.n; i += shard.nthreads) {
+		if (shard.shards != NULL) {
+			if (shard.lookup) {
+				RBshards_search(shard.shards, bench_key(i));
+			} else {
+				RBshards_insert(shard.shards, bench_key(i));
+			}
+		} else {
+			pthread_mutex_lock(&shard.lock);
+			if (shard.lookup) {
+				RBsearch(shard.tree, bench_key(i));
+			} else {
+				RBinsert(shard.tree, bench_key(i));
+			}
+			pthread_mutex_unlock(&shard.lock);
+		}
+	}
+	return NULL;
+}
+/* Runs bench_shards_worker on shard.nthreads threads and reports the time. */
+static void bench_shards_run(char *what, int sharded) {
+	pthread_t tids[64];
+	long i;
+	double t = now();
+	char name[48];
+	for (i = 0; i < shard.nthreads; i++) {
+		pthread_create(&tids[i], NULL, bench_shards_worker, (void *)i);
+	}
+	for (i = 0; i < shard.nthreads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	sprintf(name, "shards/%s/%s/%ld", sharded ? "sharded" : "locked", what,
+		shard.nthreads);
+	report(name, shard.n, shard.n, now() - t);
+}
+/* Uniform random inserts, then lookups of the same keys, from 1, 2, 4, ...
+ * threads, into one locked tree and into a container of 4 shards per CPU.
+ * Thread counts go up to the number of CPUs, and at least to 8. */
+static void bench_shards(size_t n) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int sample[1024];
+	long i;
+	int sharded;
+	if (ncpu < 1) ncpu = 1;
+	for (i = 0; i < 1024; i++) {
+		sample[i] = bench_key(i * (n / 1024 + 1));
+	}
+	pthread_mutex_init(&shard.lock, NULL);
+	shard.n = n;
+	for (shard.nthreads = 1; shard.nthreads <= 64; shard.nthreads *= 2) {
+		for (sharded = 0; sharded <= 1; sharded++) {
+			shard.shards = sharded ? RBshards_create(4 * ncpu, sample, 1024) : NULL;
+			shard.tree = sharded ? NULL : RBcreate();
+			shard.lookup = 0;
+			bench_shards_run("insert", sharded);
+			shard.lookup = 1;
+			bench_shards_run("lookup", sharded);
+			if (sharded) {
+				RBshards_free(shard.shards);
+			} else {
+				RBfree(shard.tree);
+			}
+		}
+		if (shard.nthreads >= ncpu && shard.nthreads >= 8) break;
+	}
+	pthread_mutex_destroy(&shard.lock);
+}
+
+/* Cutting a tree in two and putting it back together, versus handing half of
+ * the keys to another tree one at a time. */
+static void bench_split(size_t n) {
+	int *keys = malloc(n * sizeof(*keys));
+	rb_tree tree, lo, hi;
+	size_t i, rounds = 1000;
+	double t;
+	/* Even keys, so any odd key can be the pivot */
+	for (i = 0; i < n; i++) {
+		keys[i] = 2 * (int)i;
+	}
+	tree = RBbuild_sorted(keys, n);
+	t = now();
+	for (i = 0; i < rounds; i++) {
+		int pivot = 2 * (int)((i * 7919) % n) + 1;
+		RBsplit(tree, pivot, &lo, &hi);
+		tree = RBjoin(lo, pivot, hi);
+	}
+	report("split/RBsplit+RBjoin", n, rounds, now() - t);
+	RBfree(tree);
+
+	tree = RBbuild_sorted(keys, n);
+	hi = RBcreate();
+	t = now();
+	for (i = n / 2; i < n; i++) {
+		RBdelete(tree, keys[i]);
+		RBinsert(hi, keys[i]);
+	}
+	report_once("split/delete+insert", n, now() - t);
+	RBfree(hi);
+	RBfree(tree);
+	free(keys);
+}
+
+/* Deleting the first half of the keys in windows of k: RBdelete_range
+ * against one RBdelete per key. */
+static void bench_delete_range(size_t n) {
+	static const size_t windows[] = { 16, 1024, 65536 };
+	int *keys = malloc(n * sizeof(*keys));
+	rb_tree tree;
+	size_t i, j, w;
+	double t;
+	char name[40];
+	for (i = 0; i < n; i++) {
+		keys[i] = (int)i;
+	}
+	for (w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+		size_t k = windows[w];
+		if (k > n / 2) break;
+		tree = RBbuild_sorted(keys, n);
+		t = now();
+		for (i = 0; i + k <= n / 2; i += k) {
+			RBdelete_range(tree, keys[i], keys[i + k - 1]);
+		}
+		sprintf(name, "delrange/range-%lu", (unsigned long)k);
+		report(name, n, i, now() - t);
+		RBfree(tree);
+
+		tree = RBbuild_sorted(keys, n);
+		t = now();
+		for (i = 0; i + k <= n / 2; i += k) {
+			for (j = i; j < i + k; j++) {
+				RBdelete(tree, keys[j]);
+			}
+		}
+		sprintf(name, "delrange/RBdelete-%lu", (unsigned long)k);
+		report(name, n, i, now() - t);
+		RBfree(tree);
+	}
+	free(keys);
+}
+
+/* Copying a tree: RBclone against inserting every key into a new tree and
+ * against memcpy of the same number of nodes' bytes, then an in-order walk of
+ * the copy (nodes in key order) against the original (nodes in the order the
+ * keys were inserted). */
+static void bench_clone(size_t n) {
+	rb_tree tree = bench_tree(n), copy, back;
+	rb_cursor cur;
+	size_t bytes = n * 40; /* sizeof(struct rb_node) */
+	char *from = malloc(bytes), *to = malloc(bytes);
+	long sum = 0;
+	double t;
+
+	memset(from, 1, bytes);
+	memset(to, 0, bytes);
+	t = now();
+	memcpy(to, from, bytes);
+	report("clone/memcpy", n, n, now() - t);
+	t = now();
+	copy = RBclone(tree);
+	report("clone/RBclone", n, n, now() - t);
+	/* A copy is in key order, so copying it again walks memory in order */
+	t = now();
+	back = RBclone(copy);
+	report("clone/RBclone-of-clone", n, n, now() - t);
+	RBfree(back);
+	RBfree(copy);
+	t = now();
+	copy = bench_tree(n);
+	report("clone/RBinsert", n, n, now() - t);
+	RBfree(copy);
+
+	copy = RBclone(tree);
+	t = now();
+	for (RBfirst(tree, &cur); RBcursor_valid(&cur); RBnext(&cur)) {
+		sum += RBcursor_key(&cur);
+	}
+	report("clone/original-walk", n, n, now() - t);
+	t = now();
+	for (RBfirst(copy, &cur); RBcursor_valid(&cur); RBnext(&cur)) {
+		sum += RBcursor_key(&cur);
+	}
+	report("clone/clone-walk", n, n, now() - t);
+	/* Keep the compiler from dropping the copy and the walks */
+	if (sum == 1 || to[bytes - 1] != 1) printf("%ld\n", sum);
+	RBfree(copy);
+	RBfree(tree);
+	free(from);
+	free(to);
+}
+
+/* Merging two trees of n keys, half of them shared: RBunion and friends
+ * versus inserting (or deleting) the keys of one tree into the other. */
+static void bench_setops(size_t n) {
+	static const char *names[] = {
+		"setops/RBunion", "setops/RBintersect", "setops/RBdifference"
+	};
+	rb_tree a, b;
+	size_t i;
+	double t;
+	int op;
+	for (op = 0; op < 3; op++) {
+		a = bench_tree(n);
+		b = RBcreate();
+		for (i = n / 2; i < n + n / 2; i++) {
+			RBinsert(b, bench_key(i));
+		}
+		t = now();
+		if (op == 0) {
+			a = RBunion(a, b);
+		} else if (op == 1) {
+			a = RBintersect(a, b);
+		} else {
+			a = RBdifference(a, b);
+		}
+		report(names[op], n, 2 * n, now() - t);
+		RBfree(a);
+	}
+	a = bench_tree(n);
+	t = now();
+	for (i = n / 2; i < n + n / 2; i++) {
+		if (!RBsearch(a, bench_key(i))) {
+			RBinsert(a, bench_key(i));
+		}
+	}
+	report("setops/RBinsert", n, n, now() - t);
+	RBfree(a);
+}
+
+static struct {
+	char *name;
+	void (*run)(size_t n);
+} benches[] = {
+	{ "lookup", bench_lookup },
+	{ "build", bench_build },
+	{ "alloc", bench_alloc },
+	{ "threads", bench_threads },
+	{ "concurrent", bench_concurrent },
+	{ "shards", bench_shards },
+	{ "compact", bench_compact },
+	{ "lean", bench_lean },
+	{ "persist", bench_persist },
+	{ "frozen", bench_frozen },
+	{ "bucket", bench_bucket },
+	{ "io", bench_io },
+	{ "mapped", bench_mapped },
+	{ "suite", bench_suite },
+	{ "template", bench_template },
+	{ "split", bench_split },
+	{ "clone", bench_clone },
+	{ "delrange", bench_delete_range },
+	{ "setops", bench_setops },
+};
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+int main(int argc, char *argv[]) {
+	size_t n = DEFAULT_N;
+	size_t i;
+	int ran = 0;
+	if (argc > 2) {
+		n = strtoul(argv[2], NULL, 10);
+	}
+	for (i = 0; i < NBENCHES; i++) {
+		if (argc < 2 || strcmp(argv[1], "all") == 0
+				|| strcmp(argv[1], benches[i].name) == 0) {
+			benches[i].run(n);
+			ran = 1;
+		}
+	}
+	if (!ran) {
+		fprintf(stderr, "Usage: %s [all|benchmark] [n]\nBenchmarks:", argv[0]);
+		for (i = 0; i < NBENCHES; i++) {
+			fprintf(stderr, " %s", benches[i].name);
+		}
+		fputc('\n', stderr);
+		return 1;
+	}
+	RBcleanup();
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bench.c */
+/* Returns the current time in seconds. */
+double now();
+/* Returns the i'th key of a fixed pseudo-random sequence with no repeats. */
+int bench_key(size_t i);
+/* Prints the time per operation for ops operations on n keys. */
+void report(const char *name, size_t n, size_t ops, double secs);
+
+/* bench_suite.c */
+/* Runs every workload on every set implementation for sizes from 1000 keys up
+ * to n, and writes the results to SUITE_JSON as well as to stdout. */
+void bench_suite(size_t n);
+
+/* bench_std.cpp: std::set and std::map behind the same calls as the trees */
+/* Times rb::tree against std::map with the same key and value types. */
+void bench_template(size_t n);
+void *stdset_create();
+void stdset_free(void *set);
+int stdset_insert(void *set, int key);
+int stdset_delete(void *set, int key);
+int stdset_search(void *set, int key);
+void *stdmap_create();
+void stdmap_free(void *map);
+int stdmap_insert(void *map, int key);
+int stdmap_delete(void *map, int key);
+int stdmap_search(void *map, int key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BENCH_H */
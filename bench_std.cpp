@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "RBtree.hpp"
+#include <set>
+#include <map>
+#include <string>
+#include <cstdio>
+
+/* The map stores each key as its own value. */
+
+void *stdset_create() {
+	return new std::set<int>();
+}
+void stdset_free(void *set) {
+	delete static_cast<std::set<int> *>(set);
+}
+int stdset_insert(void *set, int key) {
+	return static_cast<std::set<int> *>(set)->insert(key).second;
+}
+int stdset_delete(void *set, int key) {
+	return static_cast<std::set<int> *>(set)->erase(key) != 0;
+}
+int stdset_search(void *set, int key) {
+	return static_cast<std::set<int> *>(set)->count(key) != 0;
+}
+
+void *stdmap_create() {
+	return new std::map<int, int>();
+}
+void stdmap_free(void *map) {
+	delete static_cast<std::map<int, int> *>(map);
+}
+int stdmap_insert(void *map, int key) {
+	return static_cast<std::map<int, int> *>(map)->insert(std::make_pair(key, key)).second;
+}
+int stdmap_delete(void *map, int key) {
+	return static_cast<std::map<int, int> *>(map)->erase(key) != 0;
+}
+int stdmap_search(void *map, int key) {
+	return static_cast<std::map<int, int> *>(map)->count(key) != 0;
+}
+
+/* Inserts, looks up (about half hits), walks and erases n keys in a map type
+ * M, with values made by make(key). */
+template <class M, class Make>
+static void bench_map(const char *name, size_t n, Make make) {
+	M m;
+	size_t i, found = 0;
+	long sum = 0;
+	double t;
+	char label[40];
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		int k = bench_key(i);
+		m.emplace(k, make(k));
+	}
+	std::snprintf(label, sizeof(label), "%s-insert", name);
+	report(label, n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) {
+		found += m.find(bench_key((i * 7919) % (2 * n))) != m.end();
+	}
+	std::snprintf(label, sizeof(label), "%s-find", name);
+	report(label, n, n, now() - t);
+	t = now();
+	for (typename M::const_iterator it = m.begin(); it != m.end(); ++it) {
+		sum += it->first;
+	}
+	std::snprintf(label, sizeof(label), "%s-iterate", name);
+	report(label, n, n, now() - t);
+	t = now();
+	for (i = 0; i < n; i++) {
+		m.erase(bench_key(i));
+	}
+	std::snprintf(label, sizeof(label), "%s-erase", name);
+	report(label, n, n, now() - t);
+	/* Keep the compiler from dropping the lookups and the walk */
+	if (found > n || sum == 1) std::printf("%lu %ld\n", (unsigned long)found, sum);
+}
+
+static int int_value(int key) {
+	return key;
+}
+static std::string string_value(int key) {
+	return std::to_string(key);
+}
+
+void bench_template(size_t n) {
+	bench_map<rb::tree<int, int> >("rb::tree<int>", n, int_value);
+	bench_map<std::map<int, int> >("std::map<int>", n, int_value);
+	bench_map<rb::tree<int, std::string> >("rb::tree<string>", n, string_value);
+	bench_map<std::map<int, std::string> >("std::map<string>", n, string_value);
+}
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "RBtree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#endif
+
+/* Where the machine-readable results go */
+#define SUITE_JSON "bench.json"
+/* Scratch file for the I/O workload */
+#define SUITE_FILE "/tmp/rbtree-suite.tmp"
+/* Smallest tree size; each size after it is 10 times bigger */
+#define SUITE_MIN_N 1000
+/* Lookup phases do at least this many lookups, so small trees time well */
+#define SUITE_MIN_LOOKUPS 1000000
+/* One op in SUITE_SAMPLE is also timed on its own, for the latency histogram;
+ * timing every one would mostly measure the clock. */
+#define SUITE_SAMPLE 8
+/* Skew of the Zipfian workload */
+#define SUITE_ZIPF_THETA 0.99
+/* Latency histogram buckets: values below 2*HIST_SUB ns get one each, and each
+ * power of two above that is split into HIST_SUB. */
+#define HIST_SUB 8
+#define HIST_BUCKETS (HIST_SUB * 62)
+/* Hardware counters we try to read */
+#define NCOUNTERS 2
+
+/* A set implementation under test */
+struct impl {
+	char *name;
+	void *(*create)();
+	void (*destroy)(void *set);
+	int (*insert)(void *set, int key);
+	int (*delete)(void *set, int key);
+	int (*search)(void *set, int key);
+};
+
+/* Draws ranks 0..n-1, rank r with probability proportional to 1/(r+1)^theta,
+ * by the method of Gray et al., "Quickly generating billion-record synthetic
+ * databases". */
+struct zipf {
+	size_t n;
+	double theta, alpha, zetan, eta;
+};
+
+/* Everything a workload's operations need */
+struct suite {
+	struct impl *impl;
+	void *set;
+	size_t n;
+	unsigned long long rng;
+	struct zipf zipf;
+	size_t found;
+	FILE *json;
+	int first_result;
+	unsigned long long clock_ns; /* cost of reading the clock twice */
+};
+
+/* One phase of a workload: a name and what to do for the i'th operation */
+struct phase {
+	char *name;
+	void (*op)(struct suite *s, size_t i);
+};
+struct workload {
+	char *name;
+	struct phase phases[3]; /* fill, lookups, then a destructive phase */
+};
+
+/* Returns the current time in nanoseconds. */
+static unsigned long long suite_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+/* Returns the next number from a xorshift generator. */
+static unsigned long long suite_rand(struct suite *s) {
+	s->rng ^= s->rng >> 12;
+	s->rng ^= s->rng << 25;
+	s->rng ^= s->rng >> 27;
+	return s->rng * 2685821657736338717ull;
+}
+/* Returns a number in [0, 1). */
+static double suite_rand01(struct suite *s) {
+	return (suite_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipf_init(struct zipf *z, size_t n, double theta) {
+	size_t i;
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (i = 1; i <= n; i++) {
+		z->zetan += 1 / pow((double)i, theta);
+	}
+	z->alpha = 1 / (1 - theta);
+	z->eta = (1 - pow(2.0 / n, 1 - theta))
+		/ (1 - (1 + pow(0.5, theta)) / z->zetan);
+}
+static size_t zipf_next(struct suite *s) {
+	struct zipf *z = &s->zipf;
+	double u = suite_rand01(s), uz = u * z->zetan;
+	size_t r;
+	if (uz < 1) return 0;
+	if (uz < 1 + pow(0.5, z->theta)) return 1;
+	r = (size_t)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+	return (r < z->n) ? r : z->n - 1;
+}
+
+/* Our trees behind the calls the suite makes */
+static void *suite_rb_create() {
+	return RBcreate();
+}
+static void suite_rb_free(void *tree) {
+	RBfree(tree);
+	/* Give the cached slabs back, so they don't count towards the next
+	 * run's memory */
+	RBcleanup();
+}
+static int suite_rb_insert(void *tree, int key) {
+	return RBinsert(tree, key);
+}
+static int suite_rb_delete(void *tree, int key) {
+	return RBdelete(tree, key);
+}
+static int suite_rb_search(void *tree, int key) {
+	return RBsearch(tree, key);
+}
+static void *suite_bucket_create() {
+	return RBbucket_create();
+}
+static void suite_bucket_free(void *bt) {
+	RBbucket_free(bt);
+}
+static int suite_bucket_insert(void *bt, int key) {
+	return RBbucket_insert(bt, key);
+}
+static int suite_bucket_delete(void *bt, int key) {
+	return RBbucket_delete(bt, key);
+}
+static int suite_bucket_search(void *bt, int key) {
+	return RBbucket_search(bt, key);
+}
+
+static struct impl impls[] = {
+	{ "rb_tree", suite_rb_create, suite_rb_free, suite_rb_insert,
+		suite_rb_delete, suite_rb_search },
+	{ "rb_btree", suite_bucket_create, suite_bucket_free, suite_bucket_insert,
+		suite_bucket_delete, suite_bucket_search },
+	{ "std::set", stdset_create, stdset_free, stdset_insert,
+		stdset_delete, stdset_search },
+	{ "std::map", stdmap_create, stdmap_free, stdmap_insert,
+		stdmap_delete, stdmap_search },
+};
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* Sequential: keys 0, 1, 2, ... in order. */
+static void seq_insert(struct suite *s, size_t i) {
+	s->impl->insert(s->set, (int)i);
+}
+static void seq_search(struct suite *s, size_t i) {
+	s->found += s->impl->search(s->set, (int)(i % s->n));
+}
+static void seq_delete(struct suite *s, size_t i) {
+	s->impl->delete(s->set, (int)i);
+}
+/* Random: distinct keys scattered over the whole int range. */
+static void random_insert(struct suite *s, size_t i) {
+	s->impl->insert(s->set, bench_key(i));
+}
+static void random_search(struct suite *s, size_t i) {
+	s->found += s->impl->search(s->set, bench_key(suite_rand(s) % s->n));
+}
+static void random_delete(struct suite *s, size_t i) {
+	s->impl->delete(s->set, bench_key(i));
+}
+/* Zipfian: a few keys get most of the lookups and updates. */
+static void zipf_search(struct suite *s, size_t i) {
+	s->found += s->impl->search(s->set, bench_key(zipf_next(s)));
+}
+static void zipf_update(struct suite *s, size_t i) {
+	int key = bench_key(zipf_next(s));
+	s->impl->delete(s->set, key);
+	s->impl->insert(s->set, key);
+}
+/* Sliding window: the newest key goes in as the oldest comes out. */
+static void window_slide(struct suite *s, size_t i) {
+	s->impl->insert(s->set, bench_key(s->n + i));
+	s->impl->delete(s->set, bench_key(i));
+}
+
+static struct workload workloads[] = {
+	{ "sequential", { { "insert", seq_insert }, { "search", seq_search },
+		{ "delete", seq_delete } } },
+	{ "random", { { "insert", random_insert }, { "search", random_search },
+		{ "delete", random_delete } } },
+	{ "zipf", { { "insert", random_insert }, { "search", zipf_search },
+		{ "update", zipf_update } } },
+	{ "window", { { "insert", random_insert }, { "search", random_search },
+		{ "slide", window_slide } } },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Adds a latency to a histogram. */
+static void hist_add(unsigned long long *hist, unsigned long long ns) {
+	int e;
+	/* Shift ns down to between HIST_SUB and 2*HIST_SUB; the shift picks
+	 * the power of two and what's left picks the bucket within it. */
+	for (e = 0; (ns >> e) >= 2 * HIST_SUB; e++)
+		;
+	hist[e * HIST_SUB + (ns >> e)]++;
+}
+/* Returns the smallest latency at or above fraction q of the samples. */
+static unsigned long long hist_quantile(unsigned long long *hist, double q) {
+	unsigned long long total = 0, seen = 0;
+	int i;
+	for (i = 0; i < HIST_BUCKETS; i++) total += hist[i];
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (total > 0 && seen >= q * total) break;
+	}
+	if (i == HIST_BUCKETS) return 0;
+	if (i < 2 * HIST_SUB) return i;
+	return (unsigned long long)(HIST_SUB + i % HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+/* Starts counting cache misses and branch mispredicts, where the kernel lets
+ * us. */
+static void counters_start(int *fd) {
+	int i;
+#ifdef __linux__
+	static const unsigned long long config[NCOUNTERS] = {
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	struct perf_event_attr pe;
+	for (i = 0; i < NCOUNTERS; i++) {
+		memset(&pe, 0, sizeof(pe));
+		pe.type = PERF_TYPE_HARDWARE;
+		pe.size = sizeof(pe);
+		pe.config = config[i];
+		pe.disabled = 1;
+		pe.exclude_kernel = 1;
+		pe.exclude_hv = 1;
+		fd[i] = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+		if (fd[i] >= 0) {
+			ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	for (i = 0; i < NCOUNTERS; i++) fd[i] = -1;
+#endif
+}
+/* Stops the counters, storing each count or -1 if it wasn't available. */
+static void counters_stop(int *fd, long long *count) {
+	int i;
+	for (i = 0; i < NCOUNTERS; i++) {
+		count[i] = -1;
+		if (fd[i] < 0) continue;
+#ifdef __linux__
+		ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+		if (read(fd[i], &count[i], sizeof(count[i])) != sizeof(count[i])) {
+			count[i] = -1;
+		}
+		close(fd[i]);
+	}
+}
+/* Resets the peak resident set size, if the kernel allows. */
+static void peak_rss_reset() {
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if (fp == NULL) return;
+	fputs("5", fp);
+	fclose(fp);
+}
+/* Returns the peak resident set size in bytes since the last reset (or since
+ * the start, if resetting isn't possible). */
+static size_t peak_rss() {
+	char line[128];
+	unsigned long kb = 0;
+	struct rusage ru;
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) break;
+		}
+		fclose(fp);
+	}
+	if (kb == 0 && getrusage(RUSAGE_SELF, &ru) == 0) {
+		kb = ru.ru_maxrss;
+	}
+	return (size_t)kb * 1024;
+}
+
+/* Prints a result and adds it to the JSON file. Latencies of 0 mean none. */
+static void suite_report(struct suite *s, char *impl, char *workload,
+		char *phase, size_t ops, double secs, unsigned long long *lat,
+		size_t rss, long long *count) {
+	char name[64];
+	int i;
+	sprintf(name, "suite/%s/%s-%s", impl, workload, phase);
+	printf("%-34s n=%-10lu %8.1f ns/op", name, (unsigned long)s->n,
+		secs * 1e9 / ops);
+	if (lat[0] > 0) {
+		printf("  p50 %5llu p99 %6llu p999 %7llu ns", lat[0], lat[1], lat[2]);
+	}
+	printf("  %7.1f MB", rss / 1e6);
+	if (count[0] >= 0) printf("  %6.2f miss/op", (double)count[0] / ops);
+	if (count[1] >= 0) printf("  %6.2f mispredict/op", (double)count[1] / ops);
+	putchar('\n');
+	fflush(stdout);
+
+	fprintf(s->json, "%s\n    {\"impl\": \"%s\", \"workload\": \"%s\", "
+		"\"phase\": \"%s\", \"n\": %lu, \"ops\": %lu, \"ns_per_op\": %.2f",
+		s->first_result ? "" : ",", impl, workload, phase,
+		(unsigned long)s->n, (unsigned long)ops, secs * 1e9 / ops);
+	s->first_result = 0;
+	if (lat[0] > 0) {
+		fprintf(s->json, ", \"p50_ns\": %llu, \"p99_ns\": %llu, "
+			"\"p999_ns\": %llu", lat[0], lat[1], lat[2]);
+	} else {
+		fprintf(s->json, ", \"p50_ns\": null, \"p99_ns\": null, "
+			"\"p999_ns\": null");
+	}
+	fprintf(s->json, ", \"peak_rss_bytes\": %lu", (unsigned long)rss);
+	for (i = 0; i < NCOUNTERS; i++) {
+		fprintf(s->json, (count[i] >= 0) ? ", \"%s\": %lld" : ", \"%s\": null",
+			i == 0 ? "cache_misses" : "branch_mispredicts", count[i]);
+	}
+	fputc('}', s->json);
+}
+
+/* Returns the least time seen between two back-to-back clock reads. */
+static unsigned long long suite_clock_cost() {
+	unsigned long long best = ~0ull, t;
+	int i;
+	for (i = 0; i < 10000; i++) {
+		t = suite_ns();
+		t = suite_ns() - t;
+		if (t < best) best = t;
+	}
+	return best;
+}
+/* Runs ops operations of one phase, timing every SUITE_SAMPLE'th. */
+static void suite_phase(struct suite *s, char *workload, struct phase *p,
+		size_t ops) {
+	static unsigned long long hist[HIST_BUCKETS];
+	unsigned long long lat[3], t;
+	long long count[NCOUNTERS];
+	int fd[NCOUNTERS];
+	size_t i;
+	double start, secs;
+	memset(hist, 0, sizeof(hist));
+	peak_rss_reset();
+	counters_start(fd);
+	start = now();
+	for (i = 0; i < ops; i++) {
+		if (i % SUITE_SAMPLE == 0) {
+			t = suite_ns();
+			p->op(s, i);
+			t = suite_ns() - t;
+			hist_add(hist, (t > s->clock_ns) ? t - s->clock_ns : 0);
+		} else {
+			p->op(s, i);
+		}
+	}
+	secs = now() - start;
+	counters_stop(fd, count);
+	lat[0] = hist_quantile(hist, 0.5);
+	lat[1] = hist_quantile(hist, 0.99);
+	lat[2] = hist_quantile(hist, 0.999);
+	suite_report(s, s->impl->name, workload, p->name, ops, secs, lat,
+		peak_rss(), count);
+}
+
+/* Saves and loads a tree of n random keys in the text format. */
+static void suite_io(struct suite *s) {
+	unsigned long long nolat[3] = { 0, 0, 0 };
+	long long count[NCOUNTERS];
+	int fd[NCOUNTERS];
+	rb_tree tree = RBcreate(), back;
+	FILE *fp;
+	size_t i;
+	double start;
+	for (i = 0; i < s->n; i++) RBinsert(tree, bench_key(i));
+	if ((fp = fopen(SUITE_FILE, "w")) == NULL) {
+		RBfree(tree);
+		return;
+	}
+	peak_rss_reset();
+	counters_start(fd);
+	start = now();
+	RBwrite_to(tree, fp);
+	fclose(fp);
+	start = now() - start;
+	counters_stop(fd, count);
+	suite_report(s, "rb_tree", "io", "RBwrite", s->n, start, nolat,
+		peak_rss(), count);
+	RBfree(tree);
+	RBcleanup();
+	peak_rss_reset();
+	counters_start(fd);
+	start = now();
+	back = RBread(SUITE_FILE);
+	start = now() - start;
+	counters_stop(fd, count);
+	suite_report(s, "rb_tree", "io", "RBread", s->n, start, nolat,
+		peak_rss(), count);
+	if (back != NULL) RBfree(back);
+	RBcleanup();
+	unlink(SUITE_FILE);
+}
+
+/* Runs every workload on every set implementation for sizes up to n. */
+void bench_suite(size_t n) {
+	struct suite s;
+	size_t w, j, size, lookups;
+	if ((s.json = fopen(SUITE_JSON, "w")) == NULL) {
+		fprintf(stderr, "Error: couldn't write file %s.\n", SUITE_JSON);
+		return;
+	}
+	s.first_result = 1;
+	s.clock_ns = suite_clock_cost();
+	fprintf(s.json, "{\"suite\": \"rbtree\", \"sample_every\": %d, "
+		"\"clock_ns\": %llu, \"results\": [", SUITE_SAMPLE, s.clock_ns);
+	for (size = SUITE_MIN_N; size <= n; size *= 10) {
+		s.n = size;
+		lookups = (size > SUITE_MIN_LOOKUPS) ? size : SUITE_MIN_LOOKUPS;
+		zipf_init(&s.zipf, size, SUITE_ZIPF_THETA);
+		for (w = 0; w < NWORKLOADS; w++) {
+			for (j = 0; j < NIMPLS; j++) {
+				s.impl = &impls[j];
+				s.rng = 0x9e3779b97f4a7c15ull;
+				s.found = 0;
+				if ((s.set = s.impl->create()) == NULL) continue;
+				suite_phase(&s, workloads[w].name, &workloads[w].phases[0], size);
+				suite_phase(&s, workloads[w].name, &workloads[w].phases[1], lookups);
+				if (s.found != lookups) {
+					fprintf(stderr, "Error: %s found %lu of %lu keys.\n",
+						s.impl->name, (unsigned long)s.found,
+						(unsigned long)lookups);
+				}
+				suite_phase(&s, workloads[w].name, &workloads[w].phases[2], size);
+				s.impl->destroy(s.set);
+			}
+		}
+		suite_io(&s);
+	}
+	fprintf(s.json, "\n]}\n");
+	fclose(s.json);
+	printf("Results written to %s\n", SUITE_JSON);
+}
@@ -26,6 +26,10 @@ int main(int argc, char *argv[]) {
 
 	printf("Louis Wilson's CSE310 Project #2\n");
 	help();
+#ifdef RB_TRACE
+	/* A tracing build shows what each command did to the tree */
+	RBtrace_hook(RBtrace_print, stderr);
+#endif
 	while (cmd != EOF) {
 		int arg;
 		printf("$ ");